@@ -4,18 +4,25 @@
  */
 
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <errno.h>
 #include <unistd.h>
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/ioctl.h>
 #include <fcntl.h>
 
+#include "eeprom.h"
+
 void usage(void)
 {
 	printf("usage:\n");
 	printf("    app -r page npages\n");
 	printf("    app -w offset text\n");
+	printf("    app -c src dst len\n");
+	printf("    app -f offset len pattern [width]\n");
+	printf("    app -s offset len\n");
 	_exit(1);
 }
 
@@ -38,6 +45,12 @@ int main(int argc, char **argv)
     if (!strcmp(argv[1], "-w")) {
         cmd = 2;
     }
+    if (!strcmp(argv[1], "-c"))
+        cmd = 3;
+    if (!strcmp(argv[1], "-f"))
+        cmd = 4;
+    if (!strcmp(argv[1], "-s"))
+        cmd = 5;
     if (!cmd)
         usage();
 
@@ -75,6 +88,65 @@ int main(int argc, char **argv)
 			printf("\n");
 			addr += 8;
 		}
+	} else if (cmd == 3) {
+		struct eeprom_copy copy;
+		if (argc < 5)
+			usage();
+		if ((fd = open(dev_name, O_RDWR)) < 0) {
+			fprintf(stderr, "%s: unable to open %s: %s\n", 
+				app_name, dev_name, strerror(errno));
+			goto Done;
+		}
+
+		copy.src = atoi(argv[2]);
+		copy.dst = atoi(argv[3]);
+		copy.len = atoi(argv[4]);
+
+		if (ioctl(fd, EEPROM_IOC_COPY, &copy) == -1) {
+			fprintf(stderr, "%s: unable to copy %s: %s\n", 
+				app_name, dev_name, strerror(errno));
+			goto Done;
+		}
+	} else if (cmd == 4) {
+		struct eeprom_fill fill;
+		if (argc < 5)
+			usage();
+		if ((fd = open(dev_name, O_RDWR)) < 0) {
+			fprintf(stderr, "%s: unable to open %s: %s\n", 
+				app_name, dev_name, strerror(errno));
+			goto Done;
+		}
+
+		fill.offset = atoi(argv[2]);
+		fill.len = atoi(argv[3]);
+		fill.pattern = strtoul(argv[4], NULL, 0);
+		fill.width = argc > 5 ? atoi(argv[5]) : 1;
+
+		if (ioctl(fd, EEPROM_IOC_FILL, &fill) == -1) {
+			fprintf(stderr, "%s: unable to fill %s: %s\n", 
+				app_name, dev_name, strerror(errno));
+			goto Done;
+		}
+	} else if (cmd == 5) {
+		struct eeprom_crc crc;
+		if (argc < 4)
+			usage();
+		if ((fd = open(dev_name, O_RDONLY)) < 0) {
+			fprintf(stderr, "%s: unable to open %s: %s\n", 
+				app_name, dev_name, strerror(errno));
+			goto Done;
+		}
+
+		crc.offset = atoi(argv[2]);
+		crc.len = atoi(argv[3]);
+		crc.flags = EEPROM_CRC_16;
+
+		if (ioctl(fd, EEPROM_IOC_CRC, &crc) == -1) {
+			fprintf(stderr, "%s: unable to checksum %s: %s\n", 
+				app_name, dev_name, strerror(errno));
+			goto Done;
+		}
+		printf("crc32 %08x crc16 %04x\n", crc.crc32, crc.crc16);
 	} else {
 		int len;
 		const char *text;
@@ -0,0 +1,258 @@
+/*
+ * eeprom.h - Interface to the LPC 17xx EEPROM driver.
+ *
+ * Shared by the kernel module and the user-space programs
+ * that talk to /dev/eeprom.
+ */
+
+#ifndef _EEPROM_H_
+#define _EEPROM_H_
+
+#include <linux/types.h>
+#include <linux/ioctl.h>
+
+/*
+ * ioctl magic number of the driver
+ */
+#define EEPROM_IOC_MAGIC		'E'
+
+/*
+ * Copy len bytes from src to dst inside the EEPROM.
+ * Source and destination may overlap.
+ */
+struct eeprom_copy {
+	__u32 src;
+	__u32 dst;
+	__u32 len;
+};
+
+#define EEPROM_IOC_COPY		_IOW(EEPROM_IOC_MAGIC, 1, struct eeprom_copy)
+
+/*
+ * Fill len bytes at offset with a repeating pattern. A pattern of
+ * width 1 is a single byte; a pattern of width 4 is a 32-bit word
+ * laid out in CPU byte order and aligned to 4-byte EEPROM addresses.
+ */
+struct eeprom_fill {
+	__u32 offset;
+	__u32 len;
+	__u32 pattern;
+	__u32 width;
+};
+
+#define EEPROM_IOC_FILL		_IOW(EEPROM_IOC_MAGIC, 2, struct eeprom_fill)
+
+/*
+ * Checksum len bytes at offset. crc32 is the standard (IEEE 802.3)
+ * CRC-32; crc16 is the CRC-16 (ARC) and is only computed on request.
+ */
+struct eeprom_crc {
+	__u32 offset;
+	__u32 len;
+	__u32 flags;
+	__u32 crc32;
+	__u16 crc16;
+	__u16 reserved;
+};
+
+#define EEPROM_CRC_16			(1 << 0)
+
+#define EEPROM_IOC_CRC		_IOWR(EEPROM_IOC_MAGIC, 3, struct eeprom_crc)
+
+/*
+ * Compare len bytes at offset with a user buffer. On return mismatch
+ * is the index of the first differing byte, or len if all bytes match.
+ */
+struct eeprom_cmp {
+	__u32 offset;
+	__u32 len;
+	__u64 buf;
+	__u32 mismatch;
+	__u32 reserved;
+};
+
+#define EEPROM_IOC_CMP		_IOWR(EEPROM_IOC_MAGIC, 4, struct eeprom_cmp)
+
+/*
+ * Compare-and-swap of up to EEPROM_CAS_MAX bytes at offset. If the
+ * EEPROM holds expected, desired is programmed and swapped is set;
+ * otherwise expected is updated with the current contents.
+ */
+#define EEPROM_CAS_MAX			64
+
+struct eeprom_cas {
+	__u32 offset;
+	__u32 len;
+	__u32 swapped;
+	__u32 reserved;
+	__u8 expected[EEPROM_CAS_MAX];
+	__u8 desired[EEPROM_CAS_MAX];
+};
+
+#define EEPROM_IOC_CAS		_IOWR(EEPROM_IOC_MAGIC, 5, struct eeprom_cas)
+
+/*
+ * 32-bit counters kept in "counter" regions of the layout. Counters
+ * are numbered across all counter regions in layout order. value is
+ * the delta for ADD and the new value for SET; on return it holds the
+ * value of the counter after the operation.
+ */
+struct eeprom_counter {
+	__u32 id;
+	__u32 value;
+};
+
+#define EEPROM_IOC_CTR_GET	_IOWR(EEPROM_IOC_MAGIC, 6, struct eeprom_counter)
+#define EEPROM_IOC_CTR_ADD	_IOWR(EEPROM_IOC_MAGIC, 7, struct eeprom_counter)
+#define EEPROM_IOC_CTR_SET	_IOWR(EEPROM_IOC_MAGIC, 8, struct eeprom_counter)
+
+/*
+ * Write back everything the driver buffers in RAM
+ */
+#define EEPROM_IOC_SYNC		_IO(EEPROM_IOC_MAGIC, 9)
+
+/*
+ * Event records kept in "log" regions. region selects the log region
+ * by its index among log regions in the layout.
+ *
+ * LOG_APPEND stores len bytes of data and returns the sequence number
+ * given to the record in seq. With EEPROM_LOG_SYNC in flags the record
+ * is programmed before the call returns; otherwise it is written back
+ * with the other buffered region state.
+ *
+ * LOG_READ returns the oldest record still held whose sequence number
+ * is at least seq, or fails with ENOENT if there is none.
+ */
+#define EEPROM_LOG_DATA_MAX		55
+#define EEPROM_LOG_SYNC			(1 << 0)
+
+struct eeprom_log_rec {
+	__u32 region;
+	__u32 seq;
+	__u32 len;
+	__u32 flags;
+	__u8 data[EEPROM_LOG_DATA_MAX];
+};
+
+#define EEPROM_IOC_LOG_APPEND	_IOWR(EEPROM_IOC_MAGIC, 10, struct eeprom_log_rec)
+#define EEPROM_IOC_LOG_READ	_IOWR(EEPROM_IOC_MAGIC, 11, struct eeprom_log_rec)
+
+/*
+ * Key/value pairs kept in "kv" regions. region selects the kv region
+ * by its index among kv regions in the layout.
+ *
+ * KV_GET looks key up and returns its value, KV_PUT stores a value
+ * and KV_DEL removes key. KV_ITER returns the pair at position cookie
+ * or later and sets cookie to the position after it; start with 0 and
+ * stop when the call fails with ENOENT.
+ */
+#define EEPROM_KV_KEY_MAX		16
+#define EEPROM_KV_VALUE_MAX		32
+
+struct eeprom_kv_rec {
+	__u32 region;
+	__u32 cookie;
+	__u8 klen;
+	__u8 vlen;
+	__u8 reserved[2];
+	__u8 key[EEPROM_KV_KEY_MAX];
+	__u8 value[EEPROM_KV_VALUE_MAX];
+};
+
+#define EEPROM_IOC_KV_GET	_IOWR(EEPROM_IOC_MAGIC, 12, struct eeprom_kv_rec)
+#define EEPROM_IOC_KV_PUT	_IOW(EEPROM_IOC_MAGIC, 13, struct eeprom_kv_rec)
+#define EEPROM_IOC_KV_DEL	_IOW(EEPROM_IOC_MAGIC, 14, struct eeprom_kv_rec)
+#define EEPROM_IOC_KV_ITER	_IOWR(EEPROM_IOC_MAGIC, 15, struct eeprom_kv_rec)
+
+/*
+ * Samples kept in "ts" regions. A ts region stores samples of a fixed
+ * number of channels, given in the layout as ts:first-last/channels.
+ * region selects the ts region by its index among ts regions.
+ *
+ * TS_APPEND adds a sample. TS_READ returns up to count samples into
+ * the array at buf, starting at cursor (0 for the oldest sample held),
+ * and sets count and cursor for the next call. Samples are buffered in
+ * RAM until a page fills up; EEPROM_IOC_SYNC writes out the rest.
+ */
+#define EEPROM_TS_CHANNELS_MAX		8
+
+struct eeprom_ts_sample {
+	__u32 time;
+	__s32 value[EEPROM_TS_CHANNELS_MAX];
+};
+
+struct eeprom_ts_append {
+	__u32 region;
+	__u32 reserved;
+	struct eeprom_ts_sample sample;
+};
+
+struct eeprom_ts_read {
+	__u32 region;
+	__u32 count;
+	__u64 cursor;
+	__u64 buf;
+};
+
+#define EEPROM_IOC_TS_APPEND	_IOW(EEPROM_IOC_MAGIC, 16, struct eeprom_ts_append)
+#define EEPROM_IOC_TS_READ	_IOWR(EEPROM_IOC_MAGIC, 17, struct eeprom_ts_read)
+
+/*
+ * Bit flags kept in "flags" regions. region selects the flags region
+ * by its index among flags regions. The calls work on nwords 32-bit
+ * flag words from word on, taking one mask per word from the array at
+ * masks: FLAGS_SET sets the masked bits, FLAGS_CLEAR clears them and
+ * FLAGS_TEST replaces each mask with the masked bits currently set.
+ */
+struct eeprom_flags {
+	__u32 region;
+	__u32 word;
+	__u32 nwords;
+	__u32 reserved;
+	__u64 masks;
+};
+
+#define EEPROM_IOC_FLAGS_SET	_IOW(EEPROM_IOC_MAGIC, 18, struct eeprom_flags)
+#define EEPROM_IOC_FLAGS_CLEAR	_IOW(EEPROM_IOC_MAGIC, 19, struct eeprom_flags)
+#define EEPROM_IOC_FLAGS_TEST	_IOW(EEPROM_IOC_MAGIC, 20, struct eeprom_flags)
+
+/*
+ * Error correction statistics, see the eeprom_ecc module parameter
+ */
+struct eeprom_ecc_stats {
+	__u32 corrected;
+	__u32 uncorrectable;
+};
+
+#define EEPROM_IOC_ECC_STATS	_IOR(EEPROM_IOC_MAGIC, 21, struct eeprom_ecc_stats)
+
+/*
+ * Verify failures of every device page, see the eeprom_verify module
+ * parameter. failures[n] counts the page at offset n * 64.
+ */
+#define EEPROM_VERIFY_PAGES		63
+
+struct eeprom_verify_stats {
+	__u32 failures[EEPROM_VERIFY_PAGES];
+};
+
+#define EEPROM_IOC_VERIFY_STATS	_IOR(EEPROM_IOC_MAGIC, 22, struct eeprom_verify_stats)
+
+#ifdef __KERNEL__
+
+/*
+ * Counter services for other kernel code
+ */
+extern int eeprom_counter_get(unsigned int id, u32 *value);
+extern int eeprom_counter_add(unsigned int id, u32 delta, u32 *value);
+extern int eeprom_counter_set(unsigned int id, u32 value);
+
+/*
+ * To be called before PCLK is raised and after it is lowered; pclk 0
+ * takes the rate from the clock driver
+ */
+extern int eeprom_clock_changed(u32 pclk);
+
+#endif /* __KERNEL__ */
+
+#endif /* _EEPROM_H_ */
@@ -0,0 +1,291 @@
+/*
+ * Benchmark of the EEPROM controller core against the simulated
+ * register block. Every workload issues the commands of eeprom_hw.c
+ * directly: reads fetch the words covering the span, writes read the
+ * page unless it is covered whole, load the page register and program.
+ * This measures the commands and the completion polling only; the
+ * driver's cache, remapping, verification, error correction and regions
+ * are not involved, so the numbers do not track driver performance.
+ * waits, polls and spin_ns are the polling counts kept by eeprom_hw.c.
+ * Results go to stdout as JSON.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+
+#include "eeprom_hw.h"
+
+#define BENCH_PCLK		60000000
+#define BENCH_OPS		200
+
+static u32 bench_pclk = BENCH_PCLK;
+static int bench_ops = BENCH_OPS;
+
+/*
+ * What the array should hold, to check the workloads against
+ */
+static u8 bench_image[EEPROM_SIZE];
+static int bench_ok = 1;
+
+static void usage(void)
+{
+	printf("usage:\n");
+	printf("    eeprom_bench [-p pclk] [-n ops] [-s seed]\n");
+	_exit(1);
+}
+
+static u64 bench_cpu_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+	return (u64) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void bench_read(u32 offset, u32 len, u8 *buf)
+{
+	u32 data[EEPROM_PAGE_WORDS];
+	u32 page, start, end, n;
+
+	while (len) {
+		page = offset / EEPROM_PAGE_SIZE;
+		start = offset % EEPROM_PAGE_SIZE;
+		n = EEPROM_PAGE_SIZE - start;
+		if (n > len)
+			n = len;
+		end = start + n;
+
+		/* 32-bit reads of the words covering the span */
+		start &= ~3;
+		EEPROM_Read(start, page, data, (end - start + 3) / 4);
+		memcpy(buf, (u8 *) data + offset % EEPROM_PAGE_SIZE - start, n);
+
+		offset += n;
+		buf += n;
+		len -= n;
+	}
+}
+
+static void bench_write(u32 offset, u32 len, const u8 *buf)
+{
+	u32 data[EEPROM_PAGE_WORDS];
+	u32 page, start, n;
+
+	memcpy(&bench_image[offset], buf, len);
+	while (len) {
+		page = offset / EEPROM_PAGE_SIZE;
+		start = offset % EEPROM_PAGE_SIZE;
+		n = EEPROM_PAGE_SIZE - start;
+		if (n > len)
+			n = len;
+
+		if (n < EEPROM_PAGE_SIZE)
+			EEPROM_Read(0, page, data, EEPROM_PAGE_WORDS);
+		memcpy((u8 *) data + start, buf, n);
+		EEPROM_WritePageRegister(0, data, EEPROM_PAGE_WORDS);
+		EEPROM_EraseProgramPage(page);
+
+		offset += n;
+		buf += n;
+		len -= n;
+	}
+}
+
+static void bench_check(u32 offset, u32 len, const u8 *buf)
+{
+	if (memcmp(&bench_image[offset], buf, len))
+		bench_ok = 0;
+}
+
+/*
+ * Workloads; each returns the number of bytes moved
+ */
+static u64 bench_seq_dump(int *ops)
+{
+	u8 buf[EEPROM_PAGE_SIZE];
+	int page;
+
+	for (page = 0; page < EEPROM_PAGE_NUM; page++) {
+		bench_read(page * EEPROM_PAGE_SIZE, EEPROM_PAGE_SIZE, buf);
+		bench_check(page * EEPROM_PAGE_SIZE, EEPROM_PAGE_SIZE, buf);
+	}
+	*ops = EEPROM_PAGE_NUM;
+	return EEPROM_SIZE;
+}
+
+static u64 bench_random_read(int *ops)
+{
+	u8 buf[16];
+	u32 offset, len;
+	u64 bytes = 0;
+	int i;
+
+	for (i = 0; i < bench_ops; i++) {
+		len = 1 + rand() % sizeof(buf);
+		offset = rand() % (EEPROM_SIZE - len + 1);
+		bench_read(offset, len, buf);
+		bench_check(offset, len, buf);
+		bytes += len;
+	}
+	*ops = bench_ops;
+	return bytes;
+}
+
+static u64 bench_scattered_write(int *ops)
+{
+	u8 buf[8];
+	u32 offset, len, j;
+	u64 bytes = 0;
+	int i;
+
+	for (i = 0; i < bench_ops; i++) {
+		len = 1 + rand() % sizeof(buf);
+		offset = rand() % (EEPROM_SIZE - len + 1);
+		for (j = 0; j < len; j++)
+			buf[j] = rand();
+		bench_write(offset, len, buf);
+		bytes += len;
+	}
+	*ops = bench_ops;
+	return bytes;
+}
+
+static u64 bench_full_rewrite(int *ops)
+{
+	static u8 buf[EEPROM_SIZE];
+	u32 j;
+
+	for (j = 0; j < EEPROM_SIZE; j++)
+		buf[j] = rand();
+	bench_write(0, EEPROM_SIZE, buf);
+	*ops = 1;
+	return EEPROM_SIZE;
+}
+
+/*
+ * Spans of an odd length and offset, crossing page boundaries
+ */
+static u64 bench_unaligned(int *ops)
+{
+	u8 buf[3 * EEPROM_PAGE_SIZE];
+	u32 offset, len, j;
+	u64 bytes = 0;
+	int i;
+
+	for (i = 0; i < bench_ops; i++) {
+		len = EEPROM_PAGE_SIZE + 7 + 2 * (rand() % EEPROM_PAGE_SIZE);
+		offset = (1 + 2 * (u32) rand()) % (EEPROM_SIZE - len);
+		if (i & 1) {
+			for (j = 0; j < len; j++)
+				buf[j] = rand();
+			bench_write(offset, len, buf);
+		} else {
+			bench_read(offset, len, buf);
+			bench_check(offset, len, buf);
+		}
+		bytes += len;
+	}
+	*ops = bench_ops;
+	return bytes;
+}
+
+static const struct {
+	const char *name;
+	u64 (*run)(int *ops);
+} bench_workloads[] = {
+	{ "seq_dump", bench_seq_dump },
+	{ "random_read", bench_random_read },
+	{ "scattered_write", bench_scattered_write },
+	{ "full_rewrite", bench_full_rewrite },
+	{ "unaligned", bench_unaligned },
+};
+
+#define BENCH_NUM_WORKLOADS \
+	(sizeof(bench_workloads) / sizeof(bench_workloads[0]))
+
+static const char *const bench_cmd_names[8] = {
+	"read8", "read16", "read32", "write8", "write16", "write32",
+	"program", "reserved"
+};
+
+int main(int argc, char **argv)
+{
+	const struct eeprom_sim_stats *st = &eeprom_sim_stats;
+	unsigned int seed = 1;
+	u64 bytes, cpu, sim;
+	unsigned int i;
+	int j, ops, opt;
+
+	while ((opt = getopt(argc, argv, "p:n:s:")) != -1) {
+		switch (opt) {
+		case 'p':
+			bench_pclk = strtoul(optarg, NULL, 0);
+			break;
+		case 'n':
+			bench_ops = atoi(optarg);
+			break;
+		case 's':
+			seed = strtoul(optarg, NULL, 0);
+			break;
+		default:
+			usage();
+		}
+	}
+	if (bench_pclk < 375000 || bench_ops <= 0)
+		usage();
+	srand(seed);
+
+	eeprom_sim_reset(bench_pclk);
+	EEPROM_Init(bench_pclk);
+	eeprom_hw_timed = 1;
+	memcpy(bench_image, eeprom_sim_flash, EEPROM_SIZE);
+
+	printf("{\n  \"pclk\": %u,\n  \"ops\": %d,\n  \"seed\": %u,\n"
+	       "  \"workloads\": [\n", bench_pclk, bench_ops, seed);
+
+	for (i = 0; i < BENCH_NUM_WORKLOADS; i++) {
+		memset(&eeprom_sim_stats, 0, sizeof(eeprom_sim_stats));
+		eeprom_hw_waits = 0;
+		eeprom_hw_polls = 0;
+		eeprom_hw_spin_ns = 0;
+		sim = eeprom_sim_now();
+		cpu = bench_cpu_ns();
+
+		bytes = bench_workloads[i].run(&ops);
+
+		cpu = bench_cpu_ns() - cpu;
+		sim = eeprom_sim_now() - sim;
+
+		printf("    {\n      \"name\": \"%s\",\n"
+		       "      \"ops\": %d,\n      \"bytes\": %llu,\n"
+		       "      \"reg_reads\": %llu,\n      \"reg_writes\": %llu,\n"
+		       "      \"waits\": %lu,\n      \"polls\": %lu,\n"
+		       "      \"cmds\": {",
+		       bench_workloads[i].name, ops, (unsigned long long) bytes,
+		       (unsigned long long) st->reg_reads,
+		       (unsigned long long) st->reg_writes,
+		       eeprom_hw_waits, eeprom_hw_polls);
+		for (j = 0; j < 8; j++)
+			printf("%s\"%s\": %llu", j ? ", " : " ",
+			       bench_cmd_names[j],
+			       (unsigned long long) st->cmds[j]);
+		printf(" },\n      \"sim_ns\": %llu,\n      \"busy_ns\": %llu,\n"
+		       "      \"spin_ns\": %llu,\n"
+		       "      \"cpu_ns\": %llu,\n      \"timing_errors\": %u\n"
+		       "    }%s\n",
+		       (unsigned long long) sim,
+		       (unsigned long long) st->busy_ns,
+		       (unsigned long long) eeprom_hw_spin_ns,
+		       (unsigned long long) cpu, st->timing_errors,
+		       i + 1 < BENCH_NUM_WORKLOADS ? "," : "");
+	}
+
+	if (memcmp(bench_image, eeprom_sim_flash, EEPROM_SIZE))
+		bench_ok = 0;
+	printf("  ],\n  \"ok\": %s\n}\n", bench_ok ? "true" : "false");
+
+	return bench_ok ? 0 : 1;
+}
@@ -0,0 +1,50 @@
+/*
+ * eeprom_capture.h - Captured /dev/eeprom workloads.
+ *
+ * A capture is a header followed by one record per operation, written
+ * by the preload shim (eeprom_shim.c) and read by eeprom_replay.
+ * Records are in host byte order.
+ */
+
+#ifndef _EEPROM_CAPTURE_H_
+#define _EEPROM_CAPTURE_H_
+
+#include <stdint.h>
+
+#define EEPROM_CAPTURE_MAGIC		0x45455043	/* "CPEE" */
+#define EEPROM_CAPTURE_VERSION		2
+
+struct eeprom_capture_hdr {
+	uint32_t magic;
+	uint32_t version;
+	uint64_t start_ns;	/* CLOCK_MONOTONIC at the start */
+};
+
+enum {
+	EEPROM_CAPTURE_OPEN,
+	EEPROM_CAPTURE_CLOSE,
+	EEPROM_CAPTURE_READ,
+	EEPROM_CAPTURE_WRITE,
+	EEPROM_CAPTURE_IOCTL,
+};
+
+/*
+ * An ioctl that works on a range of the EEPROM records it in offset and
+ * len, with EEPROM_CAPTURE_WROTE set if it wrote the range rather than
+ * read it.
+ */
+#define EEPROM_CAPTURE_WROTE		(1 << 0)
+
+struct eeprom_capture_rec {
+	uint32_t delta_us;	/* time since the previous record */
+	uint16_t offset;	/* file offset, or start of the ioctl range */
+	uint16_t len;		/* bytes moved */
+	uint8_t op;
+	uint8_t fd;		/* the file descriptor, to tell them apart */
+	int16_t result;		/* 0 or a negative errno */
+	uint8_t ioctl;		/* ioctl nr */
+	uint8_t flags;		/* EEPROM_CAPTURE_* */
+	uint16_t src;		/* source of EEPROM_IOC_COPY */
+};
+
+#endif /* _EEPROM_CAPTURE_H_ */
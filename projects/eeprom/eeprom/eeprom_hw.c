@@ -0,0 +1,126 @@
+/*
+ * eeprom_hw.c - Controller commands of the LPC 17xx EEPROM driver.
+ *
+ * Builds as part of the kernel module and, for the host, against the
+ * simulated register block (see the sim target in the Makefile).
+ */
+
+#ifdef __KERNEL__
+#include <linux/ktime.h>
+
+#define eeprom_hw_clock_ns()      ktime_to_ns(ktime_get())
+#else
+#define eeprom_hw_clock_ns()      eeprom_sim_now()
+#endif
+
+#include "eeprom_hw.h"
+
+unsigned long eeprom_hw_waits;
+unsigned long eeprom_hw_polls;
+u64 eeprom_hw_spin_ns;
+int eeprom_hw_timed;
+#ifdef __KERNEL__
+int eeprom_hw_emulated;
+#endif
+
+void EEPROM_Init(u32 pclk)
+{
+    EEPROM_DisablePowerDown();
+    EEPROM_SetClock(pclk);
+}
+
+/*
+ * Number of PCLK cycles covering ns, rounded up. The product is split
+ * at kHz to stay within 32 bits.
+ */
+static u32 EEPROM_Cycles(u32 pclk, u32 ns)
+{
+    u32 khz = (pclk / 1000) * ns;
+
+    return khz / 1000000 +
+           DIV_ROUND_UP((khz % 1000000) * 1000 + (pclk % 1000) * ns,
+                        1000000000);
+}
+
+/*
+ * Set the fastest timing that is legal at a PCLK rate. Must not be
+ * called while a command is in progress.
+ */
+void EEPROM_SetClock(u32 pclk)
+{
+    u32 val;
+
+    /* Setup EEPROM timing to at most 375KHz based on PCLK rate */
+    EEPROM_REG_WR(CLKDIV, DIV_ROUND_UP(pclk, 375000) - 1);
+
+    /* Setup EEPROM wait states to 15, 55, 35nS, minus 1 encoded */
+    val  = EEPROM_Cycles(pclk, 15) - 1;
+    val |= (EEPROM_Cycles(pclk, 55) - 1) << 8;
+    val |= (EEPROM_Cycles(pclk, 35) - 1) << 16;
+    EEPROM_SetWaitState(val);
+}
+
+static void EEPROM_WaitForIntStatus(u32 mask)
+{
+    u32 status, loops = 0;
+    int timed = eeprom_hw_timed;
+    u64 start = 0;
+
+    if (timed)
+        start = eeprom_hw_clock_ns();
+    while (1) {
+        loops++;
+        status = EEPROM_GetIntStatus();
+        if ((status & mask) == mask) {
+            break;
+        }
+    }
+    EEPROM_ClearIntStatus(mask);
+    eeprom_hw_waits++;
+    eeprom_hw_polls += loops;
+    if (timed)
+        eeprom_hw_spin_ns += eeprom_hw_clock_ns() - start;
+}
+
+/* Read 32-bit words from non-volatile memory */
+u32 EEPROM_Read(u32 pageOffset, u32 pageAddr, u32 *pData, u32 wordNum)
+{
+    u32 i;
+
+    EEPROM_ClearIntStatus(EEPROM_INT_ENDOFRW);
+    EEPROM_SetAddr(pageAddr, pageOffset);
+	EEPROM_SetCmd(EEPROM_CMD_32BITS_READ | EEPROM_CMD_RDPREFETCH);
+
+    /* read and store data in buffer */
+    for (i = 0; i < wordNum; i++) {
+        pData[i] = EEPROM_ReadData();
+        EEPROM_WaitForIntStatus(EEPROM_INT_ENDOFRW);
+    }
+    return i;
+}
+
+/* Write data from page register to non-volatile memory */
+void EEPROM_EraseProgramPage(u16 pageAddr)
+{
+    EEPROM_ClearIntStatus(EEPROM_INT_ENDOFPROG);
+    EEPROM_SetAddr(pageAddr, 0);
+    EEPROM_SetCmd(EEPROM_CMD_ERASE_PRG_PAGE);
+    EEPROM_WaitForIntStatus(EEPROM_INT_ENDOFPROG);
+}
+
+/* Write 32-bit words to page register */
+u32 EEPROM_WritePageRegister(u16 pageOffset, const u32 *pData, u32 wordNum)
+{
+    u32 i = 0;
+
+    EEPROM_ClearIntStatus(EEPROM_INT_ENDOFRW);
+	EEPROM_SetCmd(EEPROM_CMD_32BITS_WRITE);
+    EEPROM_SetAddr(0, pageOffset);
+
+    for (i = 0; i < wordNum; i++) {
+        EEPROM_WriteData(pData[i]);
+        EEPROM_WaitForIntStatus(EEPROM_INT_ENDOFRW);
+    }
+
+    return i;
+}
@@ -0,0 +1,202 @@
+/*
+ * eeprom_hw.h - Register level core of the LPC 17xx EEPROM driver.
+ *
+ * The core only touches the controller through EEPROM_REG_RD() and
+ * EEPROM_REG_WR(). In the kernel these access the EEPROM_T block at
+ * LPC_EEPROM_BASE, or the simulated block of eeprom_sim.c when
+ * eeprom_hw_emulated is set; built for the host they always go to the
+ * simulated block, so the core can run and be measured without a board.
+ */
+
+#ifndef _EEPROM_HW_H_
+#define _EEPROM_HW_H_
+
+#ifdef __KERNEL__
+#include <linux/kernel.h>
+#include <linux/types.h>
+#include <linux/stddef.h>
+#else
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+typedef uint8_t u8;
+typedef uint16_t u16;
+typedef uint32_t u32;
+typedef uint64_t u64;
+
+#define DIV_ROUND_UP(n, d)        (((n) + (d) - 1) / (d))
+#endif
+
+/*
+ * Definitions and prototypes for functions that do the actual work.
+ * Taken from LPCopen v1.03 and adopted.
+ */
+
+/* Crystal frequency into device
+   See 'osc_clk' at pg. 21 in LPC 178x/7x User Manual (UM10470.pdf) */
+#define CRYSTAL_MAIN_FREQ_IN (24000000)
+#define SYSCTL_IRC_FREQ (12000000)
+
+#define LPC_EEPROM_BASE           0x00200080
+#define LPC_EEPROM                ((EEPROM_T              *) LPC_EEPROM_BASE)
+
+/*
+ * EEPROM registers
+ */
+typedef struct {
+    u32 CMD;          /* command register */
+    u32 ADDR;         /* address register */
+    u32 WDATA;        /* write data register */
+    u32 RDATA;        /* read data register */
+    u32 WSTATE;       /* wait state register */
+    u32 CLKDIV;       /* clock divider register */
+    u32 PWRDWN;       /* power-down register */
+    u32 RESERVED0[975];
+    u32 INTENCLR;     /* interrupt enable clear */
+    u32 INTENSET;     /* interrupt enable set */
+    u32 INTSTAT;      /* interrupt status */
+    u32 INTEN;        /* interrupt enable */
+    u32 INTSTATCLR;   /* interrupt status clear */
+    u32 INTSTATSET;   /* interrupt status set */
+} EEPROM_T;
+
+
+/*
+ * EEPROM supports 4032 bytes in 63 pages with 64 bytes per page
+ */
+
+#define EEPROM_PAGE_SIZE                64
+#define EEPROM_PAGE_NUM                 63
+#define EEPROM_PAGE_WORDS               (EEPROM_PAGE_SIZE / sizeof(u32))
+#define EEPROM_SIZE                     (EEPROM_PAGE_SIZE * EEPROM_PAGE_NUM)
+
+/*
+ * defines for command register
+ */
+#define EEPROM_CMD_8BITS_READ           (0)     /* EEPROM 8-bit read command */
+#define EEPROM_CMD_16BITS_READ          (1)     /* EEPROM 16-bit read command */
+#define EEPROM_CMD_32BITS_READ          (2)     /* EEPROM 32-bit read command */
+#define EEPROM_CMD_8BITS_WRITE          (3)     /* EEPROM 8-bit write command */
+#define EEPROM_CMD_16BITS_WRITE         (4)     /* EEPROM 16-bit write command */
+#define EEPROM_CMD_32BITS_WRITE         (5)     /* EEPROM 32-bit write command */
+#define EEPROM_CMD_ERASE_PRG_PAGE       (6)     /* EEPROM erase/program command */
+#define EEPROM_CMD_RDPREFETCH           (1 << 3)/* EEPROM read pre-fetch enable */
+
+/*
+ * defines for interrupt related registers
+ */
+#define EEPROM_INT_ENDOFRW                 (1 << 26)
+#define EEPROM_INT_ENDOFPROG               (1 << 28)
+
+/*
+ * Register access
+ */
+#include "eeprom_sim.h"
+
+#define EEPROM_SIM_RD(reg)        eeprom_sim_read(offsetof(EEPROM_T, reg))
+#define EEPROM_SIM_WR(reg, val)   eeprom_sim_write(offsetof(EEPROM_T, reg), (val))
+
+#ifdef __KERNEL__
+#include <linux/compiler.h>
+#include <asm/io.h>
+
+/*
+ * Set by the driver when it runs on the ram or file backend
+ */
+extern int eeprom_hw_emulated;
+
+#define EEPROM_REG_RD(reg)                                              \
+    (unlikely(eeprom_hw_emulated) ? EEPROM_SIM_RD(reg) :                \
+                                    readl(&LPC_EEPROM->reg))
+#define EEPROM_REG_WR(reg, val)                                         \
+    do {                                                                \
+        if (unlikely(eeprom_hw_emulated))                               \
+            EEPROM_SIM_WR(reg, val);                                    \
+        else                                                            \
+            writel((val), &LPC_EEPROM->reg);                            \
+    } while (0)
+#else
+#define EEPROM_REG_RD(reg)        EEPROM_SIM_RD(reg)
+#define EEPROM_REG_WR(reg, val)   EEPROM_SIM_WR(reg, val)
+#endif
+
+/*
+ *
+ */
+static inline void EEPROM_SetCmd(u32 cmd)
+{
+    EEPROM_REG_WR(CMD, cmd);
+}
+
+static inline void EEPROM_SetAddr(u32 pageAddr, u32 pageOffset)
+{
+    EEPROM_REG_WR(ADDR, (pageAddr << 6) | pageOffset);
+}
+
+static inline void EEPROM_WriteData(u32 data)
+{
+    EEPROM_REG_WR(WDATA, data);
+}
+
+static inline u32 EEPROM_ReadData(void)
+{
+    return EEPROM_REG_RD(RDATA);
+}
+
+static inline void EEPROM_DisablePowerDown(void)
+{
+    EEPROM_REG_WR(PWRDWN, 0);
+}
+
+static inline void EEPROM_EnablePowerDown(void)
+{
+    EEPROM_REG_WR(PWRDWN, 1);
+}
+
+static inline void EEPROM_SetWaitState(u32 ws)
+{
+    EEPROM_REG_WR(WSTATE, ws);
+}
+
+static inline u32 EEPROM_GetWaitState(void)
+{
+    return EEPROM_REG_RD(WSTATE);
+}
+
+static inline u32 EEPROM_GetClkDiv(void)
+{
+    return EEPROM_REG_RD(CLKDIV);
+}
+
+static inline void EEPROM_ClearIntStatus(u32 mask)
+{
+    EEPROM_REG_WR(INTSTATCLR, mask);
+}
+
+static inline u32 EEPROM_GetIntStatus(void)
+{
+    return EEPROM_REG_RD(INTSTAT);
+}
+
+/*
+ * Controller commands, in eeprom_hw.c
+ */
+void EEPROM_Init(u32 pclk);
+void EEPROM_SetClock(u32 pclk);
+u32 EEPROM_Read(u32 pageOffset, u32 pageAddr, u32 *pData, u32 wordNum);
+void EEPROM_EraseProgramPage(u16 pageAddr);
+u32 EEPROM_WritePageRegister(u16 pageOffset, const u32 *pData, u32 wordNum);
+
+/*
+ * Completion polling done by the commands: the number of completions
+ * waited for, the number of INTSTAT reads, and with eeprom_hw_timed set
+ * the time spent in them. The callers of the commands serialise them,
+ * which covers these too.
+ */
+extern unsigned long eeprom_hw_waits;
+extern unsigned long eeprom_hw_polls;
+extern u64 eeprom_hw_spin_ns;
+extern int eeprom_hw_timed;
+
+#endif /* _EEPROM_HW_H_ */
@@ -0,0 +1,372 @@
+/*
+ * Load generator for /dev/eeprom: runs readers and writers in parallel
+ * processes for a while and reports latency percentiles, -EBUSY retries
+ * and throughput.
+ *
+ * Each operation opens the device, seeks, reads or writes and closes
+ * it, so the processes contend in eeprom_open(); an open failing with
+ * EBUSY is retried after the backoff and counted. The latency of an
+ * operation includes its retries. The parent sizes the device once;
+ * workers are started with vfork() and exec() of this program, which
+ * also works without an MMU, and send their results back through a
+ * pipe.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <time.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+
+#define LOAD_WORKERS		64
+#define LOAD_SAMPLES		16384	/* latencies kept per worker */
+#define LOAD_BUF		4096
+
+/*
+ * Settings, the same in the parent and the workers
+ */
+static const char *dev_name = "/dev/eeprom";
+static int nreaders = 1;
+static int nwriters = 1;
+static int duration = 10;		/* s */
+static int size_min = 1, size_max = 64;
+static int size_log;			/* log-uniform sizes */
+static int hot_pct;			/* ops that go to the hot area */
+static int hot_size = 256;
+static int think_us;			/* mean think time */
+static int backoff_us = 100;
+static unsigned int seed = 1;
+
+/*
+ * What a worker sends back, followed by its latencies
+ */
+struct load_result {
+	unsigned long ops;
+	unsigned long bytes;
+	unsigned long busy;		/* EBUSY retries */
+	unsigned long errors;
+	unsigned long samples;
+};
+
+static void usage(void)
+{
+	printf("usage:\n");
+	printf("    eeprom_load [-r readers] [-w writers] [-t seconds]\n");
+	printf("                [-s min-max] [-S uniform|log] [-l hot%%]\n");
+	printf("                [-H hotbytes] [-T think_us] [-b backoff_us]\n");
+	printf("                [-x seed] [device]\n");
+	_exit(1);
+}
+
+static unsigned long long now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (unsigned long long) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static unsigned int rnd_state;
+
+static unsigned int rnd(void)
+{
+	rnd_state ^= rnd_state << 13;
+	rnd_state ^= rnd_state >> 17;
+	rnd_state ^= rnd_state << 5;
+	return rnd_state;
+}
+
+static int pick_size(void)
+{
+	int bits, n;
+
+	if (!size_log)
+		return size_min + rnd() % (size_max - size_min + 1);
+
+	/* uniform in the number of bits, then within the octave */
+	for (bits = 0; (size_max >> bits) > 1; bits++)
+		;
+	do {
+		n = 1 << (rnd() % (bits + 1));
+		n += rnd() % n;
+	} while (n < size_min || n > size_max);
+	return n;
+}
+
+static int pick_offset(int size, int len)
+{
+	int area = size;
+
+	if (hot_pct && (int) (rnd() % 100) < hot_pct && hot_size < size)
+		area = hot_size;
+	if (len > area)
+		return 0;
+	return rnd() % (area - len + 1);
+}
+
+/*
+ * Open the device, retrying after the backoff while it is busy
+ */
+static int load_open(int flags, struct load_result *res)
+{
+	int fd;
+
+	while ((fd = open(dev_name, flags)) < 0) {
+		if (errno != EBUSY)
+			return -1;
+		if (res)
+			res->busy++;
+		if (backoff_us)
+			usleep(backoff_us);
+	}
+	return fd;
+}
+
+/*
+ * Open, move and close once; 1 on success, 0 on error
+ */
+static int load_op(int writer, int offset, char *buf, int len,
+		   struct load_result *res)
+{
+	int fd, ret = 0;
+
+	if ((fd = load_open(writer ? O_RDWR : O_RDONLY, res)) < 0)
+		return 0;
+	if (lseek(fd, offset, SEEK_SET) == offset &&
+	    (writer ? write(fd, buf, len) : read(fd, buf, len)) == len)
+		ret = 1;
+	close(fd);
+	return ret;
+}
+
+static int worker(int writer, int index, int out, int size)
+{
+	static unsigned int lat[LOAD_SAMPLES];
+	struct load_result res;
+	unsigned long long end, t;
+	char buf[LOAD_BUF];
+	int len, offset, i;
+
+	memset(&res, 0, sizeof(res));
+	rnd_state = seed * 2654435761u + index * 2 + writer + 1;
+
+	if (size_max > size)
+		size_max = size;
+	if (size_min > size_max)
+		size_min = size_max;
+
+	end = now_ns() + duration * 1000000000ULL;
+	while ((t = now_ns()) < end) {
+		len = pick_size();
+		offset = pick_offset(size, len);
+		if (writer)
+			for (i = 0; i < len; i++)
+				buf[i] = rnd();
+
+		if (load_op(writer, offset, buf, len, &res)) {
+			res.ops++;
+			res.bytes += len;
+			if (res.samples < LOAD_SAMPLES)
+				lat[res.samples++] = (now_ns() - t) / 1000;
+		} else
+			res.errors++;
+
+		if (think_us)
+			usleep(rnd() % (2 * think_us + 1));
+	}
+
+	if (write(out, &res, sizeof(res)) != sizeof(res) ||
+	    write(out, lat, res.samples * sizeof(lat[0])) !=
+	    (ssize_t) (res.samples * sizeof(lat[0])))
+		return 1;
+	return 0;
+}
+
+static int cmp_uint(const void *a, const void *b)
+{
+	unsigned int x = *(const unsigned int *) a, y = *(const unsigned int *) b;
+
+	return x < y ? -1 : x > y;
+}
+
+static void report(const char *name, int n, struct load_result *res,
+		   unsigned int *lat, unsigned long long ns)
+{
+	unsigned long long sum = 0;
+	unsigned long i;
+
+	printf("%s: %d processes\n", name, n);
+	if (!n)
+		return;
+	printf("    ops %lu, bytes %lu, errors %lu, ebusy retries %lu\n",
+	       res->ops, res->bytes, res->errors, res->busy);
+	printf("    throughput %.1f ops/s, %.1f bytes/s\n",
+	       res->ops * 1e9 / ns, res->bytes * 1e9 / ns);
+	if (!res->samples)
+		return;
+
+	qsort(lat, res->samples, sizeof(lat[0]), cmp_uint);
+	for (i = 0; i < res->samples; i++)
+		sum += lat[i];
+	printf("    latency us: mean %llu p50 %u p90 %u p99 %u max %u\n",
+	       sum / res->samples,
+	       lat[(res->samples - 1) * 50 / 100],
+	       lat[(res->samples - 1) * 90 / 100],
+	       lat[(res->samples - 1) * 99 / 100],
+	       lat[res->samples - 1]);
+}
+
+int main(int argc, char **argv)
+{
+	struct load_result res[2], r;
+	unsigned int *lat[2];
+	int pipes[LOAD_WORKERS], role[LOAD_WORKERS];
+	char *wargv[argc + 3], warg[32];
+	pid_t pid;
+	int opt, w, n, fd, fds[2], status, ret = 1;
+	int wrole = -1, windex = 0, wfd = -1, size = 0;
+
+	while ((opt = getopt(argc, argv, "r:w:t:s:S:l:H:T:b:x:W:")) != -1) {
+		switch (opt) {
+		case 'r':
+			nreaders = atoi(optarg);
+			break;
+		case 'w':
+			nwriters = atoi(optarg);
+			break;
+		case 't':
+			duration = atoi(optarg);
+			break;
+		case 's':
+			if (sscanf(optarg, "%d-%d", &size_min, &size_max) != 2)
+				size_max = size_min = atoi(optarg);
+			break;
+		case 'S':
+			size_log = !strcmp(optarg, "log");
+			break;
+		case 'l':
+			hot_pct = atoi(optarg);
+			break;
+		case 'H':
+			hot_size = atoi(optarg);
+			break;
+		case 'T':
+			think_us = atoi(optarg);
+			break;
+		case 'b':
+			backoff_us = atoi(optarg);
+			break;
+		case 'x':
+			seed = strtoul(optarg, NULL, 0);
+			break;
+		case 'W':
+			/* started as a worker: role:index:fd:size */
+			if (sscanf(optarg, "%d:%d:%d:%d",
+				   &wrole, &windex, &wfd, &size) != 4 || size <= 0)
+				usage();
+			break;
+		default:
+			usage();
+		}
+	}
+	if (optind < argc)
+		dev_name = argv[optind];
+	if (nreaders < 0 || nwriters < 0 ||
+	    nreaders + nwriters > LOAD_WORKERS || duration <= 0 ||
+	    size_min <= 0 || size_max < size_min || size_max > LOAD_BUF ||
+	    hot_pct < 0 || hot_pct > 100 || hot_size <= 0)
+		usage();
+
+	if (wrole >= 0)
+		return worker(wrole, windex, wfd, size);
+
+	if ((fd = load_open(O_RDONLY, NULL)) < 0 ||
+	    (size = lseek(fd, 0, SEEK_END)) <= 0) {
+		fprintf(stderr, "eeprom_load: unable to size %s: %s\n",
+			dev_name, strerror(errno));
+		goto Done;
+	}
+	close(fd);
+
+	/*
+	 * Start the workers as copies of this program, with -W first so
+	 * that getopt() sees it before the device
+	 */
+	wargv[0] = argv[0];
+	wargv[1] = "-W";
+	wargv[2] = warg;
+	memcpy(&wargv[3], &argv[1], argc * sizeof(char *));
+
+	n = nreaders + nwriters;
+	for (w = 0; w < n; w++) {
+		role[w] = w >= nreaders;
+		if (pipe(fds) < 0) {
+			fprintf(stderr, "eeprom_load: pipe: %s\n", strerror(errno));
+			goto Done;
+		}
+		fcntl(fds[0], F_SETFD, FD_CLOEXEC);
+		snprintf(warg, sizeof(warg), "%d:%d:%d:%d",
+			 role[w], w, fds[1], size);
+		pid = vfork();
+		if (pid == 0) {
+			close(fds[0]);
+			execvp(argv[0], wargv);
+			_exit(127);
+		}
+		close(fds[1]);
+		if (pid < 0) {
+			fprintf(stderr, "eeprom_load: vfork: %s\n", strerror(errno));
+			close(fds[0]);
+			goto Done;
+		}
+		pipes[w] = fds[0];
+	}
+
+	/*
+	 * Collect the results; workers block writing them until read
+	 */
+	memset(res, 0, sizeof(res));
+	lat[0] = malloc(nreaders * LOAD_SAMPLES * sizeof(unsigned int) + 1);
+	lat[1] = malloc(nwriters * LOAD_SAMPLES * sizeof(unsigned int) + 1);
+	if (!lat[0] || !lat[1]) {
+		fprintf(stderr, "eeprom_load: out of memory\n");
+		goto Done;
+	}
+	for (w = 0; w < n; w++) {
+		struct load_result *sum = &res[role[w]];
+		size_t len, got = 0;
+		ssize_t k;
+
+		if (read(pipes[w], &r, sizeof(r)) != sizeof(r)) {
+			fprintf(stderr, "eeprom_load: worker %d failed\n", w);
+			close(pipes[w]);
+			continue;
+		}
+		len = r.samples * sizeof(unsigned int);
+		while (got < len &&
+		       (k = read(pipes[w],
+				 (char *) (lat[role[w]] + sum->samples) + got,
+				 len - got)) > 0)
+			got += k;
+		close(pipes[w]);
+
+		sum->ops += r.ops;
+		sum->bytes += r.bytes;
+		sum->busy += r.busy;
+		sum->errors += r.errors;
+		sum->samples += got / sizeof(unsigned int);
+	}
+	while (wait(&status) > 0)
+		;
+
+	report("readers", nreaders, &res[0], lat[0], duration * 1000000000ULL);
+	report("writers", nwriters, &res[1], lat[1], duration * 1000000000ULL);
+	ret = 0;
+
+Done:
+	return ret;
+}
@@ -0,0 +1,3967 @@
+/*
+ * eeprom.c - A loadable kernel module for LPC 17xx EEPROMs.
+ */
+
+#include <linux/module.h>
+#include <linux/kernel.h>
+#include <linux/init.h>
+#include <linux/fs.h>
+#include <linux/mutex.h>
+#include <linux/bitops.h>
+#include <linux/string.h>
+#include <linux/crc32.h>
+#include <linux/crc16.h>
+#include <linux/slab.h>
+#include <linux/workqueue.h>
+#include <linux/jhash.h>
+#include <linux/percpu.h>
+#include <linux/debugfs.h>
+#include <linux/seq_file.h>
+#include <linux/ktime.h>
+#include <linux/delay.h>
+#include <linux/version.h>
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(4, 11, 0)
+#include <linux/sched/clock.h>
+#else
+#include <linux/sched.h>
+#endif
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(4, 3, 0)
+#include <linux/jump_label.h>
+#endif
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(5, 14, 0)
+#include <linux/panic_notifier.h>
+#endif
+#include <linux/notifier.h>
+#include <linux/kdebug.h>
+#ifdef CONFIG_CPU_FREQ
+#include <linux/cpufreq.h>
+#endif
+#include <asm/atomic.h>
+#include <asm/div64.h>
+#include <asm/uaccess.h>
+#ifdef CONFIG_ARCH_LPC178X
+#include <mach/clock.h>
+#endif
+
+#include "eeprom.h"
+#include "eeprom_hw.h"
+
+#define CREATE_TRACE_POINTS
+#include "eeprom_trace.h"
+
+/*
+ * What older kernels call, or lack
+ */
+#if LINUX_VERSION_CODE < KERNEL_VERSION(2, 6, 34)
+#define for_each_set_bit(bit, addr, size)	for_each_bit(bit, addr, size)
+#endif
+#if LINUX_VERSION_CODE < KERNEL_VERSION(2, 6, 37)
+#define local_clock()				sched_clock()
+#endif
+
+/*
+ * Driver verbosity level: 0->silent; >0->verbose
+ */
+static int eeprom_debug = 0;
+
+/*
+ * User can change verbosity of the driver. Where static keys are
+ * available, a disabled d_printk() is a patched-out branch.
+ */
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(4, 3, 0)
+static DEFINE_STATIC_KEY_FALSE(eeprom_debug_key);
+
+#define eeprom_debug_on()	static_branch_unlikely(&eeprom_debug_key)
+
+static void eeprom_debug_update(void)
+{
+	if (eeprom_debug > 0)
+		static_branch_enable(&eeprom_debug_key);
+	else
+		static_branch_disable(&eeprom_debug_key);
+}
+
+static int eeprom_debug_set(const char *val, const struct kernel_param *kp)
+{
+	int ret = param_set_int(val, kp);
+
+	if (!ret)
+		eeprom_debug_update();
+	return ret;
+}
+
+static const struct kernel_param_ops eeprom_debug_ops = {
+	.set = eeprom_debug_set,
+	.get = param_get_int
+};
+
+module_param_cb(eeprom_debug, &eeprom_debug_ops, &eeprom_debug,
+		S_IRUSR | S_IWUSR);
+#else
+#define eeprom_debug_on()	unlikely(eeprom_debug > 0)
+
+static inline void eeprom_debug_update(void)
+{
+}
+
+module_param(eeprom_debug, int, S_IRUSR | S_IWUSR);
+#endif
+MODULE_PARM_DESC(eeprom_debug, "EEPROM driver verbosity level");
+
+/*
+ * Debug messages go to a ring of fixed-size entries rather than to the
+ * kernel log, and <debugfs>/eeprom/debug drains it. A writer claims an
+ * entry with one atomic increment and never waits. An entry is complete
+ * once its seq is the position it was claimed for; entries overwritten
+ * before they are drained are reported as lost.
+ */
+#define EEPROM_DBG_ENTRIES		128	/* must be a power of 2 */
+#define EEPROM_DBG_MSG			96
+
+struct eeprom_dbg_entry {
+	unsigned int seq;
+	u64 ns;
+	char msg[EEPROM_DBG_MSG];
+};
+
+static struct eeprom_dbg_entry eeprom_dbg_ring[EEPROM_DBG_ENTRIES];
+static atomic_t eeprom_dbg_head = ATOMIC_INIT(0);
+
+static void eeprom_dbg_log(const char *fmt, ...)
+	__attribute__((format(printf, 1, 2)));
+
+static void eeprom_dbg_log(const char *fmt, ...)
+{
+	unsigned int pos = atomic_inc_return(&eeprom_dbg_head) - 1;
+	struct eeprom_dbg_entry *e =
+		&eeprom_dbg_ring[pos & (EEPROM_DBG_ENTRIES - 1)];
+	va_list args;
+
+	e->seq = pos - 1;
+	smp_wmb();
+	e->ns = ktime_to_ns(ktime_get());
+	va_start(args, fmt);
+	vsnprintf(e->msg, sizeof(e->msg), fmt, args);
+	va_end(args);
+	smp_wmb();
+	e->seq = pos;
+}
+
+/*
+ * Service to print debug messages
+ */
+#define d_printk(level, fmt, args...)					\
+	do {								\
+		if (eeprom_debug_on() && eeprom_debug >= level)	\
+			eeprom_dbg_log("%s: " fmt, __func__, ## args);	\
+	} while (0)
+
+/*
+ * Device major number
+ */
+static uint eeprom_major = 166;
+
+/*
+ * User can change the major number
+ */
+module_param(eeprom_major, uint, S_IRUSR | S_IWUSR);
+MODULE_PARM_DESC(eeprom_major, "EEPROM driver major number");
+
+/*
+ * Device name
+ */
+static char *eeprom_name = "eeprom";
+
+/*
+ * Layout of driver-managed regions: a comma-separated list of
+ * type:first-last page ranges, e.g. "counter:61-62". Only ts takes a
+ * parameter after the range, as in "ts:40-59/4", and kv needs at
+ * least two pages.
+ */
+static char *eeprom_layout = "";
+module_param(eeprom_layout, charp, S_IRUSR);
+MODULE_PARM_DESC(eeprom_layout, "EEPROM region layout (type:first-last[/arg],...)");
+
+/*
+ * How long regions, and error correction codes, may buffer updates in
+ * RAM before they are written back. 0 writes every update through
+ * immediately.
+ */
+static uint eeprom_flush_ms = 1000;
+module_param(eeprom_flush_ms, uint, S_IRUSR | S_IWUSR);
+MODULE_PARM_DESC(eeprom_flush_ms, "EEPROM region write-back delay in ms");
+
+/*
+ * Protect the pages with single-bit error correction. The codes take
+ * the top EEPROM_ECC_PAGES pages. Changed codes are written back with
+ * the regions, within eeprom_flush_ms: a code page is programmed twice
+ * in every such interval in which the pages it covers change, once to
+ * invalidate it and once with the new codes. With eeprom_flush_ms 0 it
+ * is programmed after every operation that changes them.
+ */
+static int eeprom_ecc = 0;
+module_param(eeprom_ecc, int, S_IRUSR);
+MODULE_PARM_DESC(eeprom_ecc, "EEPROM single-bit error correction (0/1); "
+		 "costs 2 programs of a code page per eeprom_flush_ms with "
+		 "writes, 1 per write with eeprom_flush_ms=0");
+
+/*
+ * Read every page back after programming it, and program it again if
+ * it does not hold the image. Spares turn this on as well.
+ */
+static int eeprom_verify = 0;
+module_param(eeprom_verify, int, S_IRUSR | S_IWUSR);
+MODULE_PARM_DESC(eeprom_verify, "EEPROM verify after program (0/1)");
+
+/*
+ * Number of spare pages kept for pages that fail to program. The
+ * spares and the page holding the remap table are taken from the top
+ * of the device, below the error correction pages. The number must
+ * not change once pages have been remapped.
+ */
+static uint eeprom_spares = 0;
+module_param(eeprom_spares, uint, S_IRUSR);
+MODULE_PARM_DESC(eeprom_spares, "EEPROM spare pages for remapping (0-16)");
+
+/*
+ * Interval between two pages checked by the background scrubber.
+ * 0 disables scrubbing. While the block is powered down or idle,
+ * pages are left due and checked together once a full pass is due.
+ */
+static uint eeprom_scrub_ms = 0;
+module_param(eeprom_scrub_ms, uint, S_IRUSR);
+MODULE_PARM_DESC(eeprom_scrub_ms, "EEPROM scrub interval per page in ms (0=off); "
+		 "when idle, one wake-up per full pass");
+
+/*
+ * Time without controller commands after which the block is powered
+ * down. 0 keeps it powered. The scrubber wakes it once every
+ * EEPROM_PAGE_NUM * eeprom_scrub_ms.
+ */
+static uint eeprom_idle_ms = 0;
+module_param(eeprom_idle_ms, uint, S_IRUSR | S_IWUSR);
+MODULE_PARM_DESC(eeprom_idle_ms, "EEPROM idle time before power-down in ms (0=off); "
+		 "the scrubber wakes the block once per full pass");
+
+/*
+ * Record latency histograms, see <debugfs>/eeprom/latency
+ */
+module_param_named(eeprom_latency, eeprom_hw_timed, int, S_IRUSR | S_IWUSR);
+MODULE_PARM_DESC(eeprom_latency, "EEPROM latency histograms (0/1)");
+
+/*
+ * What the flight recorder keeps, see <debugfs>/eeprom/recorder
+ */
+static int eeprom_recorder = 1;
+module_param(eeprom_recorder, int, S_IRUSR | S_IWUSR);
+MODULE_PARM_DESC(eeprom_recorder, "EEPROM flight recorder (0=off, 1=syscalls "
+		 "and verify failures, 2=also controller commands)");
+
+/*
+ * Where the data lives: the controller (hw), or the simulated controller
+ * of eeprom_sim.c over an array in RAM (ram) or in eeprom_file (file).
+ * The ram and file backends work on any machine.
+ */
+static char *eeprom_backend = "hw";
+module_param(eeprom_backend, charp, S_IRUSR);
+MODULE_PARM_DESC(eeprom_backend, "EEPROM backend (hw, ram or file)");
+
+static char *eeprom_file = "/var/lib/eeprom.img";
+module_param(eeprom_file, charp, S_IRUSR);
+MODULE_PARM_DESC(eeprom_file, "EEPROM image of the file backend");
+
+static uint eeprom_prog_us = 0;
+module_param(eeprom_prog_us, uint, S_IRUSR);
+MODULE_PARM_DESC(eeprom_prog_us, "EEPROM emulated program time in us "
+		 "(0=as the device)");
+
+static uint eeprom_endurance = 0;
+module_param(eeprom_endurance, uint, S_IRUSR);
+MODULE_PARM_DESC(eeprom_endurance, "EEPROM emulated programs per page "
+		 "before it wears out (0=no limit)");
+
+/*
+ * Device access lock. Only one process can access the driver at a time
+ */
+static int eeprom_lock = 0;
+
+/*
+ * Statistics, kept per CPU so that counting is a single local add.
+ * They are summed up and can be cleared through debugfs.
+ */
+struct eeprom_stats {
+	unsigned long reads;
+	unsigned long writes;
+	unsigned long read_bytes;
+	unsigned long write_bytes;
+	unsigned long programs;
+	unsigned long programs_skipped;
+	unsigned long cache_hits;
+	unsigned long cache_misses;
+	unsigned long lock_contended;
+	unsigned long powerdowns;
+	unsigned long wakeups;
+	unsigned long clock_changes;
+};
+
+static DEFINE_PER_CPU(struct eeprom_stats, eeprom_stats);
+
+#define eeprom_stat_add(field, n)	this_cpu_add(eeprom_stats.field, n)
+#define eeprom_stat_inc(field)		this_cpu_inc(eeprom_stats.field)
+
+/*
+ * Latency histograms of the read and write calls and of the controller
+ * commands, for the time taken from start to end and for the part of
+ * it spent polling for completion. Bucket 0 counts times below 1024ns,
+ * bucket n times from 1024 << (n - 1) up to twice that.
+ */
+#define EEPROM_HIST_BUCKETS		20
+
+enum {
+	EEPROM_LAT_READ,
+	EEPROM_LAT_WRITE,
+	EEPROM_LAT_PAGE_READ,
+	EEPROM_LAT_PAGE_LOAD,
+	EEPROM_LAT_PROGRAM,
+	EEPROM_LAT_NUM
+};
+
+struct eeprom_hist {
+	unsigned long wall[EEPROM_HIST_BUCKETS];
+	unsigned long spin[EEPROM_HIST_BUCKETS];
+};
+
+static DEFINE_PER_CPU(struct eeprom_hist [EEPROM_LAT_NUM], eeprom_hist);
+
+struct eeprom_lat {
+	bool on;
+	ktime_t start;
+	u64 spin;
+};
+
+static inline void eeprom_lat_start(struct eeprom_lat *lat)
+{
+	lat->on = eeprom_hw_timed;
+	if (lat->on) {
+		lat->start = ktime_get();
+		lat->spin = eeprom_hw_spin_ns;
+	}
+}
+
+static inline int eeprom_hist_bucket(u64 ns)
+{
+	ns >>= 10;
+	return ns >= 1 << (EEPROM_HIST_BUCKETS - 2) ?
+		EEPROM_HIST_BUCKETS - 1 : fls(ns);
+}
+
+/*
+ * Account a timed section. lat->spin holds the polling time of the
+ * section, as worked out by eeprom_lat_stop() or eeprom_op_end_lat().
+ */
+static void eeprom_lat_record(int class, struct eeprom_lat *lat)
+{
+	u64 wall;
+
+	if (!lat->on)
+		return;
+
+	wall = ktime_to_ns(ktime_sub(ktime_get(), lat->start));
+	this_cpu_inc(eeprom_hist[class].wall[eeprom_hist_bucket(wall)]);
+	this_cpu_inc(eeprom_hist[class].spin[eeprom_hist_bucket(lat->spin)]);
+}
+
+static inline void eeprom_lat_stop(int class, struct eeprom_lat *lat)
+{
+	lat->spin = eeprom_hw_spin_ns - lat->spin;
+	eeprom_lat_record(class, lat);
+}
+
+/*
+ * Start of a section reported by a trace event. The clock is only
+ * read when the event is enabled; an event enabled after the start
+ * reports 0 ns.
+ */
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(3, 16, 0)
+#define eeprom_trace_start(event)	\
+	(trace_##event##_enabled() ? ktime_get() : ktime_set(0, 0))
+#else
+#define eeprom_trace_start(event)	ktime_get()
+#endif
+
+/*
+ * Flight recorder: the last EEPROM_REC_ENTRIES operations. Recording
+ * claims an entry with one atomic increment and fills it in with plain
+ * stores, timed with local_clock(), which is cheaper than ktime_get().
+ * Controller commands are only recorded at eeprom_recorder level 2, so
+ * by default a command reads no clock unless its trace event is on.
+ * The recorder is shown in <debugfs>/eeprom/recorder and dumped to the
+ * kernel log on panic or oops.
+ */
+#define EEPROM_REC_ENTRIES		256	/* must be a power of 2 */
+
+#define EEPROM_REC_SYSCALLS		1
+#define EEPROM_REC_COMMANDS		2
+
+enum {
+	EEPROM_REC_READ,	/* read(), offset and length */
+	EEPROM_REC_WRITE,	/* write(), offset and length */
+	EEPROM_REC_IOCTL,	/* ioctl(), command in offset */
+	EEPROM_REC_PAGE_READ,	/* device page read */
+	EEPROM_REC_PROGRAM,	/* device page erase/program */
+	EEPROM_REC_VERIFY,	/* page failed to verify */
+};
+
+struct eeprom_rec {
+	u64 start;
+	u32 ns;
+	u32 offset;
+	s32 result;
+	u16 len;
+	u8 page;
+	u8 type;
+};
+
+static struct eeprom_rec eeprom_rec_ring[EEPROM_REC_ENTRIES];
+static atomic_t eeprom_rec_head = ATOMIC_INIT(0);
+
+/*
+ * Start of a section recorded at the given level; the clock is only
+ * read when the recorder keeps the level
+ */
+static inline u64 eeprom_rec_start(int level)
+{
+	return eeprom_recorder >= level ? local_clock() : 0;
+}
+
+static void eeprom_rec_add(int level, int type, u32 offset, u32 len,
+			   u16 page, int result, u64 start)
+{
+	unsigned int pos;
+	struct eeprom_rec *r;
+
+	if (eeprom_recorder < level)
+		return;
+
+	pos = atomic_inc_return(&eeprom_rec_head) - 1;
+	r = &eeprom_rec_ring[pos & (EEPROM_REC_ENTRIES - 1)];
+	r->start = start;
+	r->ns = start ? local_clock() - start : 0;
+	r->offset = offset;
+	r->result = result;
+	r->len = len;
+	r->page = page;
+	r->type = type;
+}
+
+/*
+ * Runtime power management. Once no command has been issued for
+ * eeprom_idle_ms and no region has writes buffered, the block is put
+ * in power-down; the next command wakes it. Reads served from the cache
+ * issue no command and leave the block powered down. The state is
+ * protected by eeprom_mutex.
+ */
+#define EEPROM_WAKE_US			100	/* settle time after power-down */
+
+static bool eeprom_pm_enabled;
+static bool eeprom_powered_down;
+static unsigned long eeprom_pm_last;
+
+static void eeprom_pm_fn(struct work_struct *work);
+static DECLARE_DELAYED_WORK(eeprom_pm_work, eeprom_pm_fn);
+
+/*
+ * Whether the block is powered down, or would be but for buffered
+ * writes or a pending check
+ */
+static bool eeprom_pm_idle(void)
+{
+	if (!eeprom_pm_enabled || !eeprom_idle_ms)
+		return false;
+	return eeprom_powered_down ||
+	       time_after_eq(jiffies, eeprom_pm_last +
+			     msecs_to_jiffies(eeprom_idle_ms));
+}
+
+static void eeprom_pm_wake(void)
+{
+	eeprom_pm_last = jiffies;
+	if (eeprom_pm_enabled && eeprom_idle_ms)
+		schedule_delayed_work(&eeprom_pm_work,
+				      msecs_to_jiffies(eeprom_idle_ms));
+
+	if (!eeprom_powered_down)
+		return;
+	EEPROM_DisablePowerDown();
+	udelay(EEPROM_WAKE_US);
+	eeprom_powered_down = false;
+	eeprom_stat_inc(wakeups);
+}
+
+/*
+ * Controller commands of eeprom_hw.c, accounted in the latency
+ * histograms, the trace events and the flight recorder
+ */
+static void eeprom_dev_read(u16 dpage, u32 *data)
+{
+	struct eeprom_lat lat;
+	ktime_t t = eeprom_trace_start(eeprom_cmd_read);
+	u64 rt = eeprom_rec_start(EEPROM_REC_COMMANDS);
+
+	eeprom_pm_wake();
+	eeprom_lat_start(&lat);
+	EEPROM_Read(0, dpage, data, EEPROM_PAGE_WORDS);
+	eeprom_lat_stop(EEPROM_LAT_PAGE_READ, &lat);
+	trace_eeprom_cmd_read(dpage, 0, EEPROM_PAGE_WORDS, t);
+	eeprom_rec_add(EEPROM_REC_COMMANDS, EEPROM_REC_PAGE_READ, 0,
+		       EEPROM_PAGE_SIZE, dpage, 0, rt);
+}
+
+static void eeprom_dev_load(const u32 *image)
+{
+	struct eeprom_lat lat;
+	ktime_t t = eeprom_trace_start(eeprom_cmd_load);
+
+	eeprom_pm_wake();
+	eeprom_lat_start(&lat);
+	EEPROM_WritePageRegister(0, image, EEPROM_PAGE_WORDS);
+	eeprom_lat_stop(EEPROM_LAT_PAGE_LOAD, &lat);
+	trace_eeprom_cmd_load(0, 0, EEPROM_PAGE_WORDS, t);
+}
+
+static void eeprom_dev_program(u16 dpage)
+{
+	struct eeprom_lat lat;
+	ktime_t t = eeprom_trace_start(eeprom_cmd_program);
+	u64 rt = eeprom_rec_start(EEPROM_REC_COMMANDS);
+
+	eeprom_pm_wake();
+	eeprom_lat_start(&lat);
+	EEPROM_EraseProgramPage(dpage);
+	eeprom_lat_stop(EEPROM_LAT_PROGRAM, &lat);
+	trace_eeprom_cmd_program(dpage, 0, EEPROM_PAGE_WORDS, t);
+	eeprom_rec_add(EEPROM_REC_COMMANDS, EEPROM_REC_PROGRAM, 0,
+		       EEPROM_PAGE_SIZE, dpage, 0, rt);
+}
+
+/*
+ * RAM copy of the EEPROM array. A page is loaded from the device the
+ * first time it is needed and is kept up to date on every page program.
+ * The cache and the controller are protected by eeprom_mutex.
+ */
+static u32 eeprom_cache[EEPROM_SIZE / sizeof(u32)];
+static DECLARE_BITMAP(eeprom_cache_valid, EEPROM_PAGE_NUM);
+static DEFINE_MUTEX(eeprom_mutex);
+
+/*
+ * CRC-32 of every cached page, updated whenever the page changes
+ */
+static u32 eeprom_page_crc[EEPROM_PAGE_NUM];
+
+/*
+ * GF(2) operator that advances a CRC-32 over one page of data,
+ * used to chain page CRCs without touching the data again
+ */
+static u32 eeprom_crc_page_op[32];
+
+static inline u32 *eeprom_cache_page(u16 page)
+{
+	return &eeprom_cache[page * EEPROM_PAGE_WORDS];
+}
+
+static inline u8 *eeprom_cache_ptr(u32 offset)
+{
+	return (u8 *) eeprom_cache + offset;
+}
+
+/*
+ * Number of pages open to users and regions; the pages above them
+ * are reserved for the driver's own use
+ */
+static u16 eeprom_pages = EEPROM_PAGE_NUM;
+
+#define EEPROM_USER_SIZE		(eeprom_pages * EEPROM_PAGE_SIZE)
+
+/*
+ * Check that [offset, offset + len) lies within the user pages
+ */
+static inline int eeprom_range_ok(u32 offset, u32 len)
+{
+	return offset <= EEPROM_USER_SIZE && len <= EEPROM_USER_SIZE - offset;
+}
+
+static inline u32 eeprom_crc32(u32 crc, const u8 *p, u32 len)
+{
+	return crc32_le(crc ^ ~0, p, len) ^ ~0;
+}
+
+static u32 eeprom_gf2_times(const u32 *mat, u32 vec)
+{
+	u32 sum = 0;
+
+	for (; vec; vec >>= 1, mat++)
+		if (vec & 1)
+			sum ^= *mat;
+	return sum;
+}
+
+/*
+ * Build the operator that appends EEPROM_PAGE_SIZE zero bytes to a
+ * CRC-32, by squaring the single zero bit operator (as zlib does)
+ */
+static void eeprom_crc_init(void)
+{
+	u32 op[32], sq[32];
+	int i, n;
+
+	op[0] = 0xedb88320;
+	for (n = 1; n < 32; n++)
+		op[n] = 1 << (n - 1);
+
+	for (i = 1; i < EEPROM_PAGE_SIZE * 8; i <<= 1) {
+		for (n = 0; n < 32; n++)
+			sq[n] = eeprom_gf2_times(op, op[n]);
+		memcpy(op, sq, sizeof(op));
+	}
+	memcpy(eeprom_crc_page_op, op, sizeof(op));
+}
+
+/*
+ * Error correction. Each protected page has a 10-bit code: the low
+ * 9 bits are the XOR of the indices of all set data bits, bit 9 is the
+ * parity of the data. A single flipped bit shows up as a code that
+ * differs in the parity and, in the low bits, by the index of the bit;
+ * a difference with even parity means a double error. The codes are
+ * dealt round the code pages, page n going to code page n % 3, so a
+ * change to one code reprograms only its own code page. A code page
+ * starts with a magic number that holds the format version and is
+ * guarded by a CRC-16 seeded with it, so that neither a blank nor an
+ * erased page passes for a table of codes. Codes are computed a byte
+ * at a time from eeprom_ecc_tab, which holds the XOR of the indices of
+ * the set bits of a byte in bits 0-2 and its parity in bit 3.
+ */
+#define EEPROM_ECC_PAGES		3
+#define EEPROM_ECC_PROTECTED		(EEPROM_PAGE_NUM - EEPROM_ECC_PAGES)
+#define EEPROM_ECC_CODES		(EEPROM_PAGE_SIZE / sizeof(u16) - 2)
+#define EEPROM_ECC_PARITY		(1 << 9)
+#define EEPROM_ECC_MAGIC		0xecc2	/* version 2 */
+
+struct eeprom_ecc_page {
+	u16 magic;
+	u16 code[EEPROM_ECC_CODES];
+	u16 crc;
+};
+
+static union {
+	struct eeprom_ecc_page p[EEPROM_ECC_PAGES];
+	u32 w[EEPROM_ECC_PAGES * EEPROM_PAGE_WORDS];
+} eeprom_ecc_tbl;
+
+#define eeprom_ecc_code(page)	\
+	eeprom_ecc_tbl.p[(page) % EEPROM_ECC_PAGES].code[(page) / EEPROM_ECC_PAGES]
+
+static u8 eeprom_ecc_tab[256];
+static bool eeprom_ecc_on;
+static DECLARE_BITMAP(eeprom_ecc_dirty, EEPROM_ECC_PAGES);
+static DECLARE_BITMAP(eeprom_ecc_open, EEPROM_ECC_PAGES);
+static u32 eeprom_ecc_corrected;
+static u32 eeprom_ecc_uncorrectable;
+
+static u16 eeprom_ecc_encode(const u32 *page)
+{
+	const u8 *p = (const u8 *) page;
+	u32 code = 0, t;
+	int i;
+
+	for (i = 0; i < EEPROM_PAGE_SIZE; i++) {
+		t = eeprom_ecc_tab[p[i]];
+		code ^= t & 7;
+		if (t & 8)
+			code ^= (i << 3) | EEPROM_ECC_PARITY;
+	}
+	return code;
+}
+
+/*
+ * Check a page just read from the device against its code, and
+ * correct it in place if a single bit flipped. Returns 1 if it did,
+ * in which case the device page still holds the flipped bit.
+ */
+static int eeprom_ecc_check(u16 page, u32 *data)
+{
+	u32 diff = eeprom_ecc_code(page) ^ eeprom_ecc_encode(data);
+
+	if (!diff)
+		return 0;
+
+	if (diff & EEPROM_ECC_PARITY) {
+		diff &= EEPROM_ECC_PARITY - 1;
+		((u8 *) data)[diff >> 3] ^= 1 << (diff & 7);
+		eeprom_ecc_corrected++;
+		printk(KERN_WARNING "%s: corrected bit %d of page %d\n",
+		       __func__, diff, page);
+		return 1;
+	}
+
+	eeprom_ecc_uncorrectable++;
+	printk(KERN_ERR "%s: uncorrectable error in page %d\n",
+	       __func__, page);
+	return 0;
+}
+
+/*
+ * Remapping of failed pages. eeprom_page_map gives the device page
+ * that holds each page; all device accesses go through it. The remap
+ * table names the page each spare stands in for, in the order the
+ * spares were taken, and is guarded by a CRC-32.
+ */
+#define EEPROM_SPARES_MAX		16
+#define EEPROM_REMAP_FREE		0xff
+
+struct eeprom_remap_table {
+	u8 spares;
+	u8 page[EEPROM_PAGE_SIZE - sizeof(u32) - 1];
+	u32 crc;
+};
+
+static union {
+	struct eeprom_remap_table t;
+	u32 w[EEPROM_PAGE_WORDS];
+} eeprom_remap_tbl;
+
+static u8 eeprom_page_map[EEPROM_PAGE_NUM];
+static u16 eeprom_remap_page;
+static u16 eeprom_spare_first;
+
+static inline bool eeprom_page_spare(u16 page)
+{
+	return page >= eeprom_spare_first && page < eeprom_remap_page;
+}
+
+static int eeprom_page_program(u16 page, const u32 *image);
+
+/*
+ * Make sure a page is present in the cache. A page corrected through
+ * its code is written back, so that the flipped bit does not stay on
+ * the device until a second one makes the page uncorrectable.
+ */
+static void eeprom_cache_fill(u16 page)
+{
+	if (test_bit(page, eeprom_cache_valid)) {
+		eeprom_stat_inc(cache_hits);
+		return;
+	}
+
+	eeprom_stat_inc(cache_misses);
+	eeprom_dev_read(eeprom_page_map[page], eeprom_cache_page(page));
+	if (eeprom_ecc_on && page < EEPROM_ECC_PROTECTED &&
+	    eeprom_ecc_check(page, eeprom_cache_page(page)))
+		eeprom_page_program(page, eeprom_cache_page(page));
+	eeprom_page_crc[page] = eeprom_crc32(0,
+		(u8 *) eeprom_cache_page(page), EEPROM_PAGE_SIZE);
+	__set_bit(page, eeprom_cache_valid);
+}
+
+/*
+ * Number of times a page is programmed again after failing to verify
+ */
+#define EEPROM_VERIFY_RETRIES		2
+
+/*
+ * Verify failures of every page
+ */
+static u32 eeprom_verify_failures[EEPROM_PAGE_NUM];
+
+static int eeprom_page_remap(u16 page);
+
+/*
+ * Load the page register with 32-bit writes and program a page. When
+ * verifying, the page is read back in one sweep and compared with the
+ * image; a page that still does not hold it after the retries is moved
+ * to a spare, if there is one, and programmed again. Returns -EIO if
+ * the page does not hold the image in the end.
+ */
+static int eeprom_page_program(u16 page, const u32 *image)
+{
+	u32 data[EEPROM_PAGE_WORDS];
+	int i;
+
+	do {
+		for (i = 0; i <= EEPROM_VERIFY_RETRIES; i++) {
+			eeprom_dev_load(image);
+			eeprom_dev_program(eeprom_page_map[page]);
+			eeprom_stat_inc(programs);
+			if (!eeprom_verify && !eeprom_spares)
+				return 0;
+
+			eeprom_dev_read(eeprom_page_map[page], data);
+			if (!memcmp(data, image, EEPROM_PAGE_SIZE))
+				return 0;
+
+			eeprom_verify_failures[page]++;
+			eeprom_rec_add(EEPROM_REC_SYSCALLS, EEPROM_REC_VERIFY,
+				       page * EEPROM_PAGE_SIZE, EEPROM_PAGE_SIZE,
+				       eeprom_page_map[page], -EIO,
+				       eeprom_rec_start(EEPROM_REC_SYSCALLS));
+			d_printk(1, "page %d failed to verify\n", page);
+		}
+	} while (eeprom_spares && !eeprom_page_remap(page));
+
+	if (!eeprom_spares)
+		printk(KERN_ERR "%s: page %d failed to program\n",
+		       __func__, page);
+	return -EIO;
+}
+
+static int eeprom_page_commit(u16 page, const u32 *image);
+
+/*
+ * Codes that change are written back within eeprom_flush_ms, so until
+ * then the code page on the device is out of date. It is invalidated
+ * before the first page it covers is programmed, which makes a load
+ * after a crash rebuild the codes rather than take stale ones for
+ * bit errors.
+ */
+static const u32 eeprom_ecc_blank[EEPROM_PAGE_WORDS];
+
+static int eeprom_ecc_invalidate(int i)
+{
+	int ret;
+
+	if (!eeprom_flush_ms || test_bit(i, eeprom_ecc_open))
+		return 0;
+
+	ret = eeprom_page_commit(EEPROM_ECC_PROTECTED + i, eeprom_ecc_blank);
+	if (!ret)
+		__set_bit(i, eeprom_ecc_open);
+	return ret;
+}
+
+/*
+ * Program a page with a new image. If the page already holds the
+ * image, the erase/program cycle is skipped altogether. A page that
+ * fails to program keeps its old image in the cache.
+ */
+static int eeprom_page_commit(u16 page, const u32 *image)
+{
+	u32 *cached = eeprom_cache_page(page);
+	int ret;
+
+	eeprom_cache_fill(page);
+	if (!memcmp(cached, image, EEPROM_PAGE_SIZE)) {
+		eeprom_stat_inc(programs_skipped);
+		return 0;
+	}
+
+	if (eeprom_ecc_on && page < EEPROM_ECC_PROTECTED) {
+		ret = eeprom_ecc_invalidate(page % EEPROM_ECC_PAGES);
+		if (ret < 0)
+			return ret;
+	}
+	ret = eeprom_page_program(page, image);
+	if (ret < 0)
+		return ret;
+	memcpy(cached, image, EEPROM_PAGE_SIZE);
+	eeprom_page_crc[page] = eeprom_crc32(0, (u8 *) cached, EEPROM_PAGE_SIZE);
+
+	if (eeprom_ecc_on && page < EEPROM_ECC_PROTECTED) {
+		eeprom_ecc_code(page) = eeprom_ecc_encode(cached);
+		__set_bit(page % EEPROM_ECC_PAGES, eeprom_ecc_dirty);
+	}
+	return 0;
+}
+
+/*
+ * Give a page that failed to program the next free spare, and persist
+ * the table. The table page itself is never remapped.
+ */
+static int eeprom_page_remap(u16 page)
+{
+	struct eeprom_remap_table *t = &eeprom_remap_tbl.t;
+	u8 old = eeprom_page_map[page];
+	int i, ret;
+
+	for (i = 0; i < eeprom_spares; i++)
+		if (t->page[i] == EEPROM_REMAP_FREE)
+			break;
+
+	if (i == eeprom_spares || page == eeprom_remap_page) {
+		printk(KERN_ERR "%s: page %d failed to program and cannot "
+		       "be remapped\n", __func__, page);
+		return -ENOSPC;
+	}
+
+	printk(KERN_WARNING "%s: page %d failed to program, moving it to "
+	       "page %d\n", __func__, page, eeprom_spare_first + i);
+	t->page[i] = page;
+	eeprom_page_map[page] = eeprom_spare_first + i;
+
+	t->crc = eeprom_crc32(0, (const u8 *) t,
+			      offsetof(struct eeprom_remap_table, crc));
+	ret = eeprom_page_commit(eeprom_remap_page, eeprom_remap_tbl.w);
+	if (ret < 0) {
+		t->page[i] = EEPROM_REMAP_FREE;
+		eeprom_page_map[page] = old;
+		t->crc = eeprom_crc32(0, (const u8 *) t,
+				      offsetof(struct eeprom_remap_table, crc));
+	}
+	return ret;
+}
+
+/*
+ * Build the page map from the remap table in the cached table page
+ */
+static int __init eeprom_remap_load(void)
+{
+	struct eeprom_remap_table *t = &eeprom_remap_tbl.t;
+	int i;
+
+	for (i = 0; i < EEPROM_PAGE_NUM; i++)
+		eeprom_page_map[i] = i;
+
+	memcpy(t, eeprom_cache_page(eeprom_remap_page), EEPROM_PAGE_SIZE);
+	if (t->crc != eeprom_crc32(0, (const u8 *) t,
+				   offsetof(struct eeprom_remap_table, crc))) {
+		d_printk(1, "no remap table in page %d\n", eeprom_remap_page);
+		memset(t, EEPROM_REMAP_FREE, sizeof(*t));
+		t->spares = eeprom_spares;
+	}
+
+	if (t->spares != eeprom_spares) {
+		printk(KERN_ALERT "%s: remap table in page %d is for %d "
+		       "spares\n", __func__, eeprom_remap_page, t->spares);
+		return -EINVAL;
+	}
+
+	for (i = 0; i < eeprom_spares; i++)
+		if (t->page[i] < eeprom_spare_first ||
+		    (t->page[i] > eeprom_remap_page &&
+		     t->page[i] < EEPROM_PAGE_NUM))
+			eeprom_page_map[t->page[i]] = eeprom_spare_first + i;
+	return 0;
+}
+
+/*
+ * Set up the page map and load the remap table. Nothing is written
+ * here: without a valid table no page is remapped yet, and the table
+ * is programmed when the first spare is taken. With error correction
+ * on, eeprom_ecc_init() checks the table page once the codes are
+ * loaded and reloads the table if a bit had to be corrected.
+ */
+static int __init eeprom_remap_init(void)
+{
+	int i, ret = 0;
+
+	for (i = 0; i < EEPROM_PAGE_NUM; i++)
+		eeprom_page_map[i] = i;
+
+	if (!eeprom_spares)
+		goto Done;
+
+	if (eeprom_spares > EEPROM_SPARES_MAX) {
+		printk(KERN_ALERT "%s: eeprom_spares can't exceed %d\n",
+		       __func__, EEPROM_SPARES_MAX);
+		ret = -EINVAL;
+		goto Done;
+	}
+
+	eeprom_remap_page = (eeprom_ecc ? EEPROM_ECC_PROTECTED :
+			     EEPROM_PAGE_NUM) - 1;
+	eeprom_spare_first = eeprom_remap_page - eeprom_spares;
+
+	eeprom_cache_fill(eeprom_remap_page);
+	ret = eeprom_remap_load();
+	if (ret < 0)
+		goto Done;
+
+	eeprom_pages = eeprom_spare_first;
+
+Done:
+	return ret;
+}
+
+static inline u16 eeprom_ecc_crc(const struct eeprom_ecc_page *e)
+{
+	return crc16(EEPROM_ECC_MAGIC, (const u8 *) e,
+		     offsetof(struct eeprom_ecc_page, crc));
+}
+
+/*
+ * Program the code pages whose codes have changed or that have been
+ * invalidated. A page that fails stays due for the next sync.
+ */
+static int eeprom_ecc_sync(void)
+{
+	struct eeprom_ecc_page *e;
+	int i, err, ret = 0;
+
+	for (i = 0; i < EEPROM_ECC_PAGES; i++) {
+		if (!test_bit(i, eeprom_ecc_dirty) &&
+		    !test_bit(i, eeprom_ecc_open))
+			continue;
+
+		e = &eeprom_ecc_tbl.p[i];
+		e->magic = EEPROM_ECC_MAGIC;
+		e->crc = eeprom_ecc_crc(e);
+		err = eeprom_page_commit(EEPROM_ECC_PROTECTED + i,
+					 &eeprom_ecc_tbl.w[i * EEPROM_PAGE_WORDS]);
+		if (err < 0) {
+			ret = err;
+			continue;
+		}
+		__clear_bit(i, eeprom_ecc_dirty);
+		__clear_bit(i, eeprom_ecc_open);
+	}
+	return ret;
+}
+
+/*
+ * Set up error correction. Without a valid table on the device, the
+ * codes are computed from the pages as they are.
+ *
+ * The remap table page was read before any codes were loaded, so it is
+ * checked here, before the codes of other pages are computed through
+ * the page map it gives.
+ */
+static int __init eeprom_ecc_init(void)
+{
+	DECLARE_BITMAP(invalid, EEPROM_ECC_PAGES);
+	struct eeprom_ecc_page *e;
+	u16 page = eeprom_remap_page;
+	int i, j, ret;
+
+	BUILD_BUG_ON(sizeof(struct eeprom_ecc_page) != EEPROM_PAGE_SIZE);
+	BUILD_BUG_ON(EEPROM_ECC_PAGES * EEPROM_ECC_CODES < EEPROM_ECC_PROTECTED);
+
+	if (!eeprom_ecc)
+		return 0;
+
+	for (i = 0; i < 256; i++)
+		for (j = 0; j < 8; j++)
+			if (i & (1 << j))
+				eeprom_ecc_tab[i] = (eeprom_ecc_tab[i] ^ j) ^ 8;
+
+	bitmap_zero(invalid, EEPROM_ECC_PAGES);
+	for (i = 0; i < EEPROM_ECC_PAGES; i++) {
+		e = &eeprom_ecc_tbl.p[i];
+		eeprom_cache_fill(EEPROM_ECC_PROTECTED + i);
+		memcpy(e, eeprom_cache_page(EEPROM_ECC_PROTECTED + i),
+		       EEPROM_PAGE_SIZE);
+		if (e->magic != EEPROM_ECC_MAGIC || e->crc != eeprom_ecc_crc(e))
+			__set_bit(i, invalid);
+	}
+
+	if (eeprom_spares && !test_bit(page % EEPROM_ECC_PAGES, invalid) &&
+	    eeprom_ecc_check(page, eeprom_cache_page(page))) {
+		eeprom_page_program(page, eeprom_cache_page(page));
+		eeprom_page_crc[page] = eeprom_crc32(0,
+			(u8 *) eeprom_cache_page(page), EEPROM_PAGE_SIZE);
+		ret = eeprom_remap_load();
+		if (ret < 0)
+			return ret;
+	}
+
+	for_each_set_bit(i, invalid, EEPROM_ECC_PAGES) {
+		e = &eeprom_ecc_tbl.p[i];
+		printk(KERN_WARNING "%s: no valid codes in page %d, "
+		       "computing them\n", __func__, EEPROM_ECC_PROTECTED + i);
+		memset(e, 0, sizeof(*e));
+		for (j = i; j < EEPROM_ECC_PROTECTED; j += EEPROM_ECC_PAGES) {
+			eeprom_cache_fill(j);
+			eeprom_ecc_code(j) = eeprom_ecc_encode(eeprom_cache_page(j));
+		}
+		__set_bit(i, eeprom_ecc_dirty);
+	}
+	eeprom_ecc_sync();
+
+	eeprom_pages = min_t(u16, eeprom_pages, EEPROM_ECC_PROTECTED);
+	eeprom_ecc_on = true;
+	return 0;
+}
+
+static void eeprom_flush_fn(struct work_struct *work);
+static DECLARE_DELAYED_WORK(eeprom_flush_work, eeprom_flush_fn);
+
+/*
+ * Write changed codes back now, or with eeprom_flush_ms set along with
+ * the regions
+ */
+static void eeprom_ecc_writeback(void)
+{
+	if (bitmap_empty(eeprom_ecc_dirty, EEPROM_ECC_PAGES))
+		return;
+
+	if (!eeprom_flush_ms)
+		eeprom_ecc_sync();
+	else
+		schedule_delayed_work(&eeprom_flush_work,
+				      msecs_to_jiffies(eeprom_flush_ms));
+}
+
+/*
+ * Number of callers waiting to start an operation
+ */
+static atomic_t eeprom_op_waiters = ATOMIC_INIT(0);
+
+/*
+ * Start and end an operation on the EEPROM. Code pages are brought up
+ * to date at the end of an operation rather than after every page.
+ */
+static inline void eeprom_op_begin(void)
+{
+	if (mutex_trylock(&eeprom_mutex))
+		return;
+
+	eeprom_stat_inc(lock_contended);
+	atomic_inc(&eeprom_op_waiters);
+	mutex_lock(&eeprom_mutex);
+	atomic_dec(&eeprom_op_waiters);
+}
+
+static void eeprom_op_end(void)
+{
+	eeprom_ecc_writeback();
+	mutex_unlock(&eeprom_mutex);
+}
+
+/*
+ * The same, for operations timed by a struct eeprom_lat that was
+ * started before eeprom_op_begin_lat(). Only the polling done while
+ * the mutex is held is charged to the operation.
+ */
+static inline void eeprom_op_begin_lat(struct eeprom_lat *lat)
+{
+	eeprom_op_begin();
+	lat->spin = eeprom_hw_spin_ns;
+}
+
+static void eeprom_op_end_lat(struct eeprom_lat *lat)
+{
+	eeprom_ecc_writeback();
+	lat->spin = eeprom_hw_spin_ns - lat->spin;
+	mutex_unlock(&eeprom_mutex);
+}
+
+/*
+ * Background scrubbing. Every eeprom_scrub_ms the next page is read
+ * back from the device and checked against the cache, which holds what
+ * was last programmed; a page that is not cached yet is loaded first,
+ * which corrects it through its code if error correction is on. The
+ * cache itself is checked against its page CRC. A page that differs on
+ * the device is reprogrammed from the cache; a cached page that fails
+ * its CRC is reloaded from the device if the device copy passes.
+ *
+ * The scrubber never waits for the mutex: if an operation is running
+ * or about to start, the page stays due until the next interval, and
+ * it stops after any page an operation has started waiting behind. So
+ * as not to keep the block out of power-down, due pages are left while
+ * it is powered down or idle until a full pass is due, and then checked
+ * together; the commands of the scrubber do not count as activity.
+ */
+static void eeprom_scrub_fn(struct work_struct *work);
+static DECLARE_DELAYED_WORK(eeprom_scrub_work, eeprom_scrub_fn);
+static u16 eeprom_scrub_page;
+static unsigned int eeprom_scrub_due;
+
+static void eeprom_scrub_one(u16 page)
+{
+	u32 data[EEPROM_PAGE_WORDS];
+	u32 *cached = eeprom_cache_page(page);
+
+	eeprom_cache_fill(page);
+	eeprom_dev_read(eeprom_page_map[page], data);
+
+	if (eeprom_page_crc[page] !=
+	    eeprom_crc32(0, (u8 *) cached, EEPROM_PAGE_SIZE)) {
+		if (eeprom_page_crc[page] !=
+		    eeprom_crc32(0, (u8 *) data, EEPROM_PAGE_SIZE)) {
+			printk(KERN_ERR "%s: page %d fails its CRC in RAM "
+			       "and on the device\n", __func__, page);
+			return;
+		}
+		printk(KERN_WARNING "%s: reloaded page %d into RAM\n",
+		       __func__, page);
+		memcpy(cached, data, EEPROM_PAGE_SIZE);
+		return;
+	}
+
+	if (memcmp(cached, data, EEPROM_PAGE_SIZE)) {
+		printk(KERN_WARNING "%s: rewriting page %d\n", __func__, page);
+		eeprom_page_program(page, cached);
+	}
+}
+
+static void eeprom_scrub_fn(struct work_struct *work)
+{
+	unsigned long last;
+
+	if (eeprom_scrub_due < EEPROM_PAGE_NUM)
+		eeprom_scrub_due++;
+	if (atomic_read(&eeprom_op_waiters) || !mutex_trylock(&eeprom_mutex))
+		goto Done;
+
+	if (eeprom_pm_idle() && eeprom_scrub_due < EEPROM_PAGE_NUM) {
+		mutex_unlock(&eeprom_mutex);
+		goto Done;
+	}
+
+	last = eeprom_pm_last;
+	while (eeprom_scrub_due) {
+		eeprom_scrub_one(eeprom_scrub_page);
+		eeprom_scrub_due--;
+
+		/*
+		 * Spares hold other pages' data or nothing at all
+		 */
+		do {
+			if (++eeprom_scrub_page == EEPROM_PAGE_NUM)
+				eeprom_scrub_page = 0;
+		} while (eeprom_page_spare(eeprom_scrub_page));
+
+		if (atomic_read(&eeprom_op_waiters))
+			break;
+	}
+	eeprom_pm_last = last;
+	mutex_unlock(&eeprom_mutex);
+
+Done:
+	schedule_delayed_work(&eeprom_scrub_work,
+			      msecs_to_jiffies(eeprom_scrub_ms));
+}
+
+/*
+ * Write a kernel buffer to a range, programming each page once
+ */
+static int eeprom_store(u32 offset, const u8 *buf, u32 len)
+{
+	u32 image[EEPROM_PAGE_WORDS];
+	u32 end = offset + len, n;
+	u16 page;
+	int ret;
+
+	for (; offset < end; offset += n, buf += n) {
+		page = offset >> 6;
+		n = min_t(u32, end, (page + 1) * EEPROM_PAGE_SIZE) - offset;
+
+		eeprom_cache_fill(page);
+		memcpy(image, eeprom_cache_page(page), EEPROM_PAGE_SIZE);
+		memcpy((u8 *) image + (offset & (EEPROM_PAGE_SIZE - 1)), buf, n);
+		ret = eeprom_page_commit(page, image);
+		if (ret < 0)
+			return ret;
+	}
+	return 0;
+}
+
+/*
+ * Copy a range inside the EEPROM with memmove() semantics. Source bytes
+ * are taken from the cache and each destination page is programmed once.
+ */
+static int eeprom_copy(const struct eeprom_copy *c)
+{
+	u32 image[EEPROM_PAGE_WORDS];
+	u32 start, end, n;
+	int page, step, ret;
+
+	if (!eeprom_range_ok(c->src, c->len) ||
+	    !eeprom_range_ok(c->dst, c->len))
+		return -EINVAL;
+
+	if (c->len == 0 || c->src == c->dst)
+		return 0;
+
+	for (page = c->src >> 6; page <= (c->src + c->len - 1) >> 6; page++)
+		eeprom_cache_fill(page);
+
+	/*
+	 * If the destination lies above the source, walk it backwards so
+	 * that overlapping source bytes are consumed before they change
+	 */
+	n = ((c->dst + c->len - 1) >> 6) - (c->dst >> 6) + 1;
+	if (c->dst > c->src) {
+		page = (c->dst + c->len - 1) >> 6;
+		step = -1;
+	} else {
+		page = c->dst >> 6;
+		step = 1;
+	}
+
+	for (; n > 0; n--, page += step) {
+		start = max_t(u32, c->dst, page * EEPROM_PAGE_SIZE);
+		end = min_t(u32, c->dst + c->len, (page + 1) * EEPROM_PAGE_SIZE);
+
+		eeprom_cache_fill(page);
+		memcpy(image, eeprom_cache_page(page), EEPROM_PAGE_SIZE);
+		memcpy((u8 *) image + (start & (EEPROM_PAGE_SIZE - 1)),
+		       eeprom_cache_ptr(start - c->dst + c->src), end - start);
+		ret = eeprom_page_commit(page, image);
+		if (ret < 0)
+			return ret;
+	}
+
+	return 0;
+}
+
+/*
+ * Fill a range with a byte or 32-bit pattern. Whole pages are built
+ * directly from the pattern; only partial pages need the cached image.
+ */
+static int eeprom_fill(const struct eeprom_fill *f)
+{
+	u32 image[EEPROM_PAGE_WORDS];
+	u32 pattern, start, end, i;
+	const u8 *p = (const u8 *) &pattern;
+	u16 page;
+	int ret;
+
+	if (!eeprom_range_ok(f->offset, f->len))
+		return -EINVAL;
+
+	switch (f->width) {
+	case 1:
+		pattern = (f->pattern & 0xff) * 0x01010101;
+		break;
+	case 4:
+		pattern = f->pattern;
+		break;
+	default:
+		return -EINVAL;
+	}
+
+	for (start = f->offset; start < f->offset + f->len; start = end) {
+		page = start >> 6;
+		end = min_t(u32, f->offset + f->len, (page + 1) * EEPROM_PAGE_SIZE);
+
+		if (end - start == EEPROM_PAGE_SIZE) {
+			for (i = 0; i < EEPROM_PAGE_WORDS; i++)
+				image[i] = pattern;
+		} else {
+			eeprom_cache_fill(page);
+			memcpy(image, eeprom_cache_page(page), EEPROM_PAGE_SIZE);
+			for (i = start; i < end; i++)
+				((u8 *) image)[i & (EEPROM_PAGE_SIZE - 1)] = p[i & 3];
+		}
+
+		/* Pages that already hold the pattern are not programmed */
+		ret = eeprom_page_commit(page, image);
+		if (ret < 0)
+			return ret;
+	}
+
+	return 0;
+}
+
+/*
+ * Checksum a range. Whole pages contribute their maintained CRC, so
+ * only the partial pages at either end are run through the CRC kernel.
+ */
+static int eeprom_crc(struct eeprom_crc *c)
+{
+	u32 offset, end, n, crc = 0;
+	u16 page;
+
+	if (!eeprom_range_ok(c->offset, c->len))
+		return -EINVAL;
+
+	end = c->offset + c->len;
+	for (offset = c->offset; offset < end; offset += n) {
+		page = offset >> 6;
+		n = min_t(u32, end, (page + 1) * EEPROM_PAGE_SIZE) - offset;
+
+		eeprom_cache_fill(page);
+		if (n == EEPROM_PAGE_SIZE)
+			crc = eeprom_gf2_times(eeprom_crc_page_op, crc) ^
+				eeprom_page_crc[page];
+		else
+			crc = eeprom_crc32(crc, eeprom_cache_ptr(offset), n);
+	}
+	c->crc32 = crc;
+
+	/* The range is fully cached by now */
+	c->crc16 = 0;
+	if (c->flags & EEPROM_CRC_16)
+		c->crc16 = crc16(0, eeprom_cache_ptr(c->offset), c->len);
+
+	return 0;
+}
+
+/*
+ * Compare a range with a user buffer, a page slice at a time
+ */
+static int eeprom_cmp(struct eeprom_cmp *c)
+{
+	const u8 __user *buf = (const u8 __user *)(unsigned long) c->buf;
+	u8 chunk[EEPROM_PAGE_SIZE];
+	u32 offset, end, n, i;
+	u16 page;
+
+	if (!eeprom_range_ok(c->offset, c->len))
+		return -EINVAL;
+
+	end = c->offset + c->len;
+	for (offset = c->offset; offset < end; offset += n, buf += n) {
+		page = offset >> 6;
+		n = min_t(u32, end, (page + 1) * EEPROM_PAGE_SIZE) - offset;
+
+		if (copy_from_user(chunk, buf, n))
+			return -EFAULT;
+
+		eeprom_cache_fill(page);
+		if (memcmp(chunk, eeprom_cache_ptr(offset), n)) {
+			for (i = 0; chunk[i] == eeprom_cache_ptr(offset)[i]; i++)
+				;
+			c->mismatch = offset + i - c->offset;
+			return 0;
+		}
+	}
+	c->mismatch = c->len;
+
+	return 0;
+}
+
+/*
+ * Compare-and-swap. Runs entirely under eeprom_mutex, so it is atomic
+ * with respect to every other user of the driver, and nothing is
+ * programmed when the comparison fails.
+ */
+static int eeprom_cas(struct eeprom_cas *c)
+{
+	u16 page;
+	int ret;
+
+	if (c->len > EEPROM_CAS_MAX || !eeprom_range_ok(c->offset, c->len))
+		return -EINVAL;
+
+	if (c->len == 0) {
+		c->swapped = 1;
+		return 0;
+	}
+
+	for (page = c->offset >> 6; page <= (c->offset + c->len - 1) >> 6; page++)
+		eeprom_cache_fill(page);
+
+	if (memcmp(eeprom_cache_ptr(c->offset), c->expected, c->len)) {
+		memcpy(c->expected, eeprom_cache_ptr(c->offset), c->len);
+		c->swapped = 0;
+		return 0;
+	}
+
+	ret = eeprom_store(c->offset, c->desired, c->len);
+	if (ret < 0)
+		return ret;
+	c->swapped = 1;
+
+	return 0;
+}
+
+/*
+ * Driver-managed regions. A region owns a range of pages and lays
+ * out its data there according to its type. Region state lives in
+ * RAM and is protected by eeprom_mutex like the cache.
+ *
+ * flush() writes back buffered state. It is called with sync false for
+ * the periodic write-back, and with sync true when everything a region
+ * holds in RAM must reach the EEPROM. State that fails to be written
+ * stays buffered, and the error is returned.
+ *
+ * has_arg tells whether the type takes a parameter after its range in
+ * eeprom_layout, and min_pages how many pages it needs at least.
+ */
+struct eeprom_region;
+
+struct eeprom_region_type {
+	const char *name;
+	bool has_arg;
+	u16 min_pages;
+	int (*load)(struct eeprom_region *r);
+	int (*flush)(struct eeprom_region *r, bool sync);
+};
+
+struct eeprom_region {
+	const struct eeprom_region_type *type;
+	u16 first;
+	u16 npages;
+	u32 arg;
+	void *priv;
+};
+
+#define EEPROM_REGION_MAX		8
+
+static struct eeprom_region eeprom_regions[EEPROM_REGION_MAX];
+static int eeprom_region_num;
+
+/*
+ * Write back buffered region state, returning the first error
+ */
+static int eeprom_regions_flush(bool sync)
+{
+	int i, err, ret = 0;
+
+	for (i = 0; i < eeprom_region_num; i++) {
+		if (!eeprom_regions[i].type->flush)
+			continue;
+		err = eeprom_regions[i].type->flush(&eeprom_regions[i], sync);
+		if (err < 0 && !ret)
+			ret = err;
+	}
+	return ret;
+}
+
+static void eeprom_flush_fn(struct work_struct *work)
+{
+	int ret;
+
+	eeprom_op_begin();
+	ret = eeprom_regions_flush(false);
+	if (!ret)
+		ret = eeprom_ecc_sync();
+	eeprom_op_end();
+
+	if (ret < 0)
+		printk(KERN_ERR "%s: write-back failed with %d\n",
+		       __func__, ret);
+}
+
+/*
+ * Power the block down if it has been idle long enough, or look again
+ * once it could have been
+ */
+static void eeprom_pm_fn(struct work_struct *work)
+{
+	unsigned long idle = msecs_to_jiffies(eeprom_idle_ms);
+
+	mutex_lock(&eeprom_mutex);
+	if (!eeprom_pm_enabled || !eeprom_idle_ms || eeprom_powered_down)
+		goto Done;
+
+	if (delayed_work_pending(&eeprom_flush_work)) {
+		schedule_delayed_work(&eeprom_pm_work, idle);
+		goto Done;
+	}
+	if (time_before(jiffies, eeprom_pm_last + idle)) {
+		schedule_delayed_work(&eeprom_pm_work,
+				      eeprom_pm_last + idle - jiffies);
+		goto Done;
+	}
+
+	EEPROM_EnablePowerDown();
+	eeprom_powered_down = true;
+	eeprom_stat_inc(powerdowns);
+
+Done:
+	mutex_unlock(&eeprom_mutex);
+}
+
+/*
+ * Note that a region has buffered state, and arrange for it to be
+ * written back within eeprom_flush_ms
+ */
+static int eeprom_region_dirty(struct eeprom_region *r)
+{
+	if (!eeprom_flush_ms)
+		return r->type->flush(r, false);
+
+	schedule_delayed_work(&eeprom_flush_work,
+			      msecs_to_jiffies(eeprom_flush_ms));
+	return 0;
+}
+
+/*
+ * Find the index'th region of a type
+ */
+static struct eeprom_region *eeprom_region_find(
+	const struct eeprom_region_type *type, unsigned int index)
+{
+	int i;
+
+	for (i = 0; i < eeprom_region_num; i++)
+		if (eeprom_regions[i].type == type && index-- == 0)
+			return &eeprom_regions[i];
+	return NULL;
+}
+
+/*
+ * Counter regions. Each page of the region holds a full snapshot of
+ * the region's counters together with a sequence number. Snapshots go
+ * to the pages of the region in turn, so every page sees only a
+ * fraction of the flushes, and increments between flushes cost nothing.
+ */
+#define EEPROM_COUNTER_SLOTS		14
+
+struct eeprom_counter_rec {
+	u32 seq;
+	u32 value[EEPROM_COUNTER_SLOTS];
+	u32 crc;
+};
+
+struct eeprom_counters {
+	u32 value[EEPROM_COUNTER_SLOTS];
+	u32 seq;
+	u16 next;
+	bool dirty;
+};
+
+static int eeprom_counter_load(struct eeprom_region *r)
+{
+	const struct eeprom_counter_rec *rec, *best = NULL;
+	struct eeprom_counters *c;
+	u16 i;
+
+	BUILD_BUG_ON(sizeof(struct eeprom_counter_rec) != EEPROM_PAGE_SIZE);
+
+	c = kzalloc(sizeof(*c), GFP_KERNEL);
+	if (!c)
+		return -ENOMEM;
+
+	/*
+	 * The most recent valid snapshot wins; the next one goes to the
+	 * page after it
+	 */
+	for (i = 0; i < r->npages; i++) {
+		eeprom_cache_fill(r->first + i);
+		rec = (const struct eeprom_counter_rec *)
+			eeprom_cache_page(r->first + i);
+		if (rec->crc != eeprom_crc32(0, (const u8 *) rec,
+					     offsetof(struct eeprom_counter_rec, crc)))
+			continue;
+		if (!best || rec->seq > best->seq) {
+			best = rec;
+			c->next = (i + 1) % r->npages;
+		}
+	}
+
+	if (best) {
+		memcpy(c->value, best->value, sizeof(c->value));
+		c->seq = best->seq;
+	}
+	r->priv = c;
+
+	return 0;
+}
+
+static int eeprom_counter_flush(struct eeprom_region *r, bool sync)
+{
+	struct eeprom_counters *c = r->priv;
+	struct eeprom_counter_rec rec;
+	int ret;
+
+	if (!c->dirty)
+		return 0;
+
+	rec.seq = ++c->seq;
+	memcpy(rec.value, c->value, sizeof(rec.value));
+	rec.crc = eeprom_crc32(0, (const u8 *) &rec,
+			       offsetof(struct eeprom_counter_rec, crc));
+	ret = eeprom_page_commit(r->first + c->next, (const u32 *) &rec);
+	if (ret < 0) {
+		c->seq--;
+		return ret;
+	}
+
+	c->next = (c->next + 1) % r->npages;
+	c->dirty = false;
+	return 0;
+}
+
+static const struct eeprom_region_type eeprom_counter_type = {
+	.name = "counter",
+	.load = eeprom_counter_load,
+	.flush = eeprom_counter_flush,
+};
+
+/*
+ * Find the region holding counter id
+ */
+static struct eeprom_region *eeprom_counter_find(unsigned int *id)
+{
+	int i;
+
+	for (i = 0; i < eeprom_region_num; i++) {
+		if (eeprom_regions[i].type != &eeprom_counter_type)
+			continue;
+		if (*id < EEPROM_COUNTER_SLOTS)
+			return &eeprom_regions[i];
+		*id -= EEPROM_COUNTER_SLOTS;
+	}
+	return NULL;
+}
+
+/*
+ * Get, add to or set a counter. Called with eeprom_mutex held.
+ */
+static int eeprom_counter_op(unsigned int cmd, struct eeprom_counter *ctr)
+{
+	unsigned int slot = ctr->id;
+	struct eeprom_region *r = eeprom_counter_find(&slot);
+	struct eeprom_counters *c;
+
+	if (!r)
+		return -EINVAL;
+
+	c = r->priv;
+	switch (cmd) {
+	case EEPROM_IOC_CTR_ADD:
+		c->value[slot] += ctr->value;
+		break;
+
+	case EEPROM_IOC_CTR_SET:
+		c->value[slot] = ctr->value;
+		break;
+	}
+
+	ctr->value = c->value[slot];
+	if (cmd != EEPROM_IOC_CTR_GET) {
+		c->dirty = true;
+		return eeprom_region_dirty(r);
+	}
+
+	return 0;
+}
+
+int eeprom_counter_get(unsigned int id, u32 *value)
+{
+	struct eeprom_counter ctr = { .id = id };
+	int ret;
+
+	eeprom_op_begin();
+	ret = eeprom_counter_op(EEPROM_IOC_CTR_GET, &ctr);
+	eeprom_op_end();
+
+	if (!ret)
+		*value = ctr.value;
+	return ret;
+}
+EXPORT_SYMBOL(eeprom_counter_get);
+
+int eeprom_counter_add(unsigned int id, u32 delta, u32 *value)
+{
+	struct eeprom_counter ctr = { .id = id, .value = delta };
+	int ret;
+
+	eeprom_op_begin();
+	ret = eeprom_counter_op(EEPROM_IOC_CTR_ADD, &ctr);
+	eeprom_op_end();
+
+	if (!ret && value)
+		*value = ctr.value;
+	return ret;
+}
+EXPORT_SYMBOL(eeprom_counter_add);
+
+int eeprom_counter_set(unsigned int id, u32 value)
+{
+	struct eeprom_counter ctr = { .id = id, .value = value };
+	int ret;
+
+	eeprom_op_begin();
+	ret = eeprom_counter_op(EEPROM_IOC_CTR_SET, &ctr);
+	eeprom_op_end();
+
+	return ret;
+}
+EXPORT_SYMBOL(eeprom_counter_set);
+
+/*
+ * Log regions. Records are packed into pages as a 4-byte sequence
+ * number, a length byte and the data; the last word of a page is a
+ * CRC-32 of the rest. Appends collect in a RAM image of the head page,
+ * which is programmed as a whole, so there is no header to rewrite.
+ * Sequence numbers grow from page to page around the ring, which lets
+ * the head be found at load by a binary search over first records.
+ */
+#define EEPROM_LOG_HDR_SIZE		5
+#define EEPROM_LOG_AREA			(EEPROM_PAGE_SIZE - sizeof(u32))
+
+struct eeprom_log {
+	u32 image[EEPROM_PAGE_WORDS];
+	u32 next_seq;
+	u16 head;
+	u16 fill;
+	bool dirty;
+};
+
+static inline u32 eeprom_log_seq(const u8 *p)
+{
+	u32 seq;
+
+	memcpy(&seq, p, sizeof(seq));
+	return seq;
+}
+
+/*
+ * Get a page of a log region, or NULL if it holds no valid records
+ */
+static const u8 *eeprom_log_page(struct eeprom_region *r, u16 i)
+{
+	struct eeprom_log *log = r->priv;
+	const u32 *page;
+
+	if (log && i == log->head)
+		return (const u8 *) log->image;
+
+	eeprom_cache_fill(r->first + i);
+	page = eeprom_cache_page(r->first + i);
+	if (page[EEPROM_PAGE_WORDS - 1] !=
+	    eeprom_crc32(0, (const u8 *) page, EEPROM_LOG_AREA) ||
+	    !eeprom_log_seq((const u8 *) page))
+		return NULL;
+	return (const u8 *) page;
+}
+
+/*
+ * Sequence number of the first record in a page, 0 if there is none
+ */
+static u32 eeprom_log_first_seq(struct eeprom_region *r, u16 i)
+{
+	const u8 *p = eeprom_log_page(r, i);
+
+	return p ? eeprom_log_seq(p) : 0;
+}
+
+static int eeprom_log_load(struct eeprom_region *r)
+{
+	struct eeprom_log *log;
+	u32 first, seq;
+	u16 lo, hi, mid, off;
+	const u8 *p;
+
+	log = kzalloc(sizeof(*log), GFP_KERNEL);
+	if (!log)
+		return -ENOMEM;
+
+	/*
+	 * First sequence numbers rise up to the head page and then either
+	 * drop to older pages or to empty ones, so the head is the last
+	 * page whose first record is not older than that of page 0
+	 */
+	lo = 0;
+	hi = r->npages - 1;
+	first = eeprom_log_first_seq(r, 0);
+	if (first) {
+		while (lo < hi) {
+			mid = (lo + hi + 1) / 2;
+			if (eeprom_log_first_seq(r, mid) >= first)
+				lo = mid;
+			else
+				hi = mid - 1;
+		}
+	}
+	log->head = lo;
+	log->next_seq = 1;
+
+	/*
+	 * Pick up the records already in the head page
+	 */
+	p = eeprom_log_page(r, log->head);
+	if (p) {
+		memcpy(log->image, p, EEPROM_PAGE_SIZE);
+		for (off = 0; off + EEPROM_LOG_HDR_SIZE <= EEPROM_LOG_AREA;
+		     off += EEPROM_LOG_HDR_SIZE + p[off + 4]) {
+			seq = eeprom_log_seq(p + off);
+			if (!seq)
+				break;
+			log->next_seq = seq + 1;
+		}
+		log->fill = off;
+	}
+	r->priv = log;
+
+	d_printk(2, "log head=%d,fill=%d,seq=%u\n", log->head, log->fill,
+		 log->next_seq);
+	return 0;
+}
+
+static int eeprom_log_flush(struct eeprom_region *r, bool sync)
+{
+	struct eeprom_log *log = r->priv;
+	int ret;
+
+	if (!log->dirty)
+		return 0;
+
+	log->image[EEPROM_PAGE_WORDS - 1] =
+		eeprom_crc32(0, (const u8 *) log->image, EEPROM_LOG_AREA);
+	ret = eeprom_page_commit(r->first + log->head, log->image);
+	if (ret < 0)
+		return ret;
+	log->dirty = false;
+	return 0;
+}
+
+static const struct eeprom_region_type eeprom_log_type = {
+	.name = "log",
+	.load = eeprom_log_load,
+	.flush = eeprom_log_flush,
+};
+
+static int eeprom_log_append(struct eeprom_log_rec *rec)
+{
+	struct eeprom_region *r = eeprom_region_find(&eeprom_log_type,
+						     rec->region);
+	struct eeprom_log *log;
+	u8 *p;
+	int ret;
+
+	if (!r || rec->len > EEPROM_LOG_DATA_MAX)
+		return -EINVAL;
+	log = r->priv;
+
+	/*
+	 * Move on to the next page, dropping the oldest one, when the
+	 * record does not fit into the head page
+	 */
+	if (log->fill + EEPROM_LOG_HDR_SIZE + rec->len > EEPROM_LOG_AREA) {
+		ret = eeprom_log_flush(r, true);
+		if (ret < 0)
+			return ret;
+		log->head = (log->head + 1) % r->npages;
+		log->fill = 0;
+		memset(log->image, 0, sizeof(log->image));
+	}
+
+	rec->seq = log->next_seq++;
+	p = (u8 *) log->image + log->fill;
+	memcpy(p, &rec->seq, sizeof(rec->seq));
+	p[4] = rec->len;
+	memcpy(p + EEPROM_LOG_HDR_SIZE, rec->data, rec->len);
+	log->fill += EEPROM_LOG_HDR_SIZE + rec->len;
+	log->dirty = true;
+
+	if (rec->flags & EEPROM_LOG_SYNC)
+		return eeprom_log_flush(r, true);
+	return eeprom_region_dirty(r);
+}
+
+static int eeprom_log_read(struct eeprom_log_rec *rec)
+{
+	struct eeprom_region *r = eeprom_region_find(&eeprom_log_type,
+						     rec->region);
+	struct eeprom_log *log;
+	const u8 *p;
+	u16 i, n, off;
+	u32 seq;
+
+	if (!r)
+		return -EINVAL;
+	log = r->priv;
+
+	/*
+	 * Walk the ring from the page after the head, the oldest one
+	 */
+	for (n = 0; n < r->npages; n++) {
+		i = (log->head + 1 + n) % r->npages;
+		p = eeprom_log_page(r, i);
+		if (!p)
+			continue;
+
+		for (off = 0; off + EEPROM_LOG_HDR_SIZE <= EEPROM_LOG_AREA;
+		     off += EEPROM_LOG_HDR_SIZE + p[off + 4]) {
+			seq = eeprom_log_seq(p + off);
+			if (!seq)
+				break;
+			if (seq < rec->seq)
+				continue;
+
+			rec->seq = seq;
+			rec->len = min_t(u32, p[off + 4], EEPROM_LOG_DATA_MAX);
+			memcpy(rec->data, p + off + EEPROM_LOG_HDR_SIZE, rec->len);
+			return 0;
+		}
+	}
+
+	return -ENOENT;
+}
+
+/*
+ * Key/value regions. The region is a log of TLV records: a key length,
+ * a value length (EEPROM_KV_DELETED for a deletion) and the bytes of
+ * both. Each page starts with a sequence number, ends with a CRC-32,
+ * and is written once as the active page; puts append to a RAM image of
+ * it. The pages in use run from tail to active around the ring.
+ *
+ * A RAM hash index maps every live key to its latest record, so lookups
+ * never touch the EEPROM. Garbage collection works on the tail page:
+ * each put first moves as many live records from the tail as fit into
+ * the active page, so no call ever programs more than one page, and a
+ * fully drained tail page becomes free. The active page and the tail
+ * must differ, so a region takes at least two pages.
+ */
+#define EEPROM_KV_AREA_START		sizeof(u32)
+#define EEPROM_KV_AREA_END		(EEPROM_PAGE_SIZE - sizeof(u32))
+#define EEPROM_KV_DELETED		0xff
+#define EEPROM_KV_BUCKETS		64
+#define EEPROM_KV_NIL			0xffff
+#define EEPROM_KV_GC_FREE		2
+
+struct eeprom_kv_ent {
+	u16 next;
+	u8 page;
+	u8 off;
+};
+
+struct eeprom_kv {
+	u32 image[EEPROM_PAGE_WORDS];
+	u32 next_seq;
+	u16 active;
+	u16 tail;
+	u16 used;
+	u16 fill;
+	u16 gc_off;
+	bool dirty;
+	u16 free;
+	u16 nents;
+	u16 hash[EEPROM_KV_BUCKETS];
+	struct eeprom_kv_ent ents[0];
+};
+
+/*
+ * Get the record at off in a page of the region
+ */
+static const u8 *eeprom_kv_rec(struct eeprom_region *r, u16 page, u16 off)
+{
+	struct eeprom_kv *kv = r->priv;
+
+	if (page == kv->active)
+		return (const u8 *) kv->image + off;
+	return (const u8 *) eeprom_cache_page(r->first + page) + off;
+}
+
+static inline u16 eeprom_kv_rec_len(const u8 *p)
+{
+	return 2 + p[0] + (p[1] == EEPROM_KV_DELETED ? 0 : p[1]);
+}
+
+/*
+ * Check the lengths of the record at off before anything copies it:
+ * the page CRC only shows that the page is as it was written
+ */
+static bool eeprom_kv_rec_ok(const u8 *p, u16 off)
+{
+	return p[0] && p[0] <= EEPROM_KV_KEY_MAX &&
+		(p[1] == EEPROM_KV_DELETED || p[1] <= EEPROM_KV_VALUE_MAX) &&
+		off + eeprom_kv_rec_len(p) <= EEPROM_KV_AREA_END;
+}
+
+static inline u16 *eeprom_kv_bucket(struct eeprom_kv *kv, const u8 *key,
+				    u8 klen)
+{
+	return &kv->hash[jhash(key, klen, 0) & (EEPROM_KV_BUCKETS - 1)];
+}
+
+/*
+ * Find the index entry of a key, EEPROM_KV_NIL if it is not stored
+ */
+static u16 eeprom_kv_lookup(struct eeprom_region *r, const u8 *key, u8 klen)
+{
+	struct eeprom_kv *kv = r->priv;
+	const u8 *p;
+	u16 i;
+
+	for (i = *eeprom_kv_bucket(kv, key, klen); i != EEPROM_KV_NIL;
+	     i = kv->ents[i].next) {
+		p = eeprom_kv_rec(r, kv->ents[i].page, kv->ents[i].off);
+		if (p[0] == klen && !memcmp(p + 2, key, klen))
+			return i;
+	}
+	return EEPROM_KV_NIL;
+}
+
+static void eeprom_kv_insert(struct eeprom_kv *kv, const u8 *key, u8 klen,
+			     u16 page, u16 off)
+{
+	u16 *bucket = eeprom_kv_bucket(kv, key, klen);
+	u16 i = kv->free;
+
+	kv->free = kv->ents[i].next;
+	kv->ents[i].page = page;
+	kv->ents[i].off = off;
+	kv->ents[i].next = *bucket;
+	*bucket = i;
+}
+
+static void eeprom_kv_remove(struct eeprom_kv *kv, const u8 *key, u8 klen,
+			     u16 i)
+{
+	u16 *link = eeprom_kv_bucket(kv, key, klen);
+
+	while (*link != i)
+		link = &kv->ents[*link].next;
+	*link = kv->ents[i].next;
+
+	kv->ents[i].page = EEPROM_KV_NIL & 0xff;
+	kv->ents[i].next = kv->free;
+	kv->free = i;
+}
+
+/*
+ * Bring the index up to date with the record at off in page
+ */
+static void eeprom_kv_apply(struct eeprom_region *r, u16 page, u16 off)
+{
+	struct eeprom_kv *kv = r->priv;
+	const u8 *p = eeprom_kv_rec(r, page, off);
+	u16 i = eeprom_kv_lookup(r, p + 2, p[0]);
+
+	if (p[1] == EEPROM_KV_DELETED) {
+		if (i != EEPROM_KV_NIL)
+			eeprom_kv_remove(kv, p + 2, p[0], i);
+	} else if (i != EEPROM_KV_NIL) {
+		kv->ents[i].page = page;
+		kv->ents[i].off = off;
+	} else if (kv->free != EEPROM_KV_NIL) {
+		eeprom_kv_insert(kv, p + 2, p[0], page, off);
+	}
+}
+
+/*
+ * Check that a page of the region holds a valid record log
+ */
+static bool eeprom_kv_page_ok(struct eeprom_region *r, u16 page)
+{
+	const u32 *p;
+
+	eeprom_cache_fill(r->first + page);
+	p = eeprom_cache_page(r->first + page);
+	return p[0] && p[EEPROM_PAGE_WORDS - 1] ==
+		eeprom_crc32(0, (const u8 *) p, EEPROM_KV_AREA_END);
+}
+
+/*
+ * Start a new, empty active page
+ */
+static void eeprom_kv_open_page(struct eeprom_kv *kv, u16 page)
+{
+	memset(kv->image, 0, sizeof(kv->image));
+	kv->image[0] = kv->next_seq++;
+	kv->active = page;
+	kv->fill = EEPROM_KV_AREA_START;
+}
+
+static int eeprom_kv_load(struct eeprom_region *r)
+{
+	struct eeprom_kv *kv;
+	const u8 *p;
+	u32 seq, best = 0;
+	u16 i, n, off;
+
+	n = r->npages * (EEPROM_KV_AREA_END - EEPROM_KV_AREA_START) / 3;
+	kv = kzalloc(sizeof(*kv) + n * sizeof(kv->ents[0]), GFP_KERNEL);
+	if (!kv)
+		return -ENOMEM;
+
+	kv->nents = n;
+	kv->free = EEPROM_KV_NIL;
+	for (i = n; i-- > 0; ) {
+		kv->ents[i].page = EEPROM_KV_NIL & 0xff;
+		kv->ents[i].next = kv->free;
+		kv->free = i;
+	}
+	memset(kv->hash, 0xff, sizeof(kv->hash));
+	r->priv = kv;
+
+	/*
+	 * The page with the highest sequence number was the active one;
+	 * the oldest page in use is the first valid one after it
+	 */
+	kv->active = EEPROM_KV_NIL;
+	for (i = 0; i < r->npages; i++) {
+		if (!eeprom_kv_page_ok(r, i))
+			continue;
+		seq = eeprom_cache_page(r->first + i)[0];
+		if (seq > best) {
+			best = seq;
+			kv->active = i;
+		}
+	}
+	kv->next_seq = best + 1;
+
+	if (kv->active == EEPROM_KV_NIL) {
+		eeprom_kv_open_page(kv, 0);
+		kv->tail = 0;
+		kv->used = 1;
+		kv->gc_off = EEPROM_KV_AREA_START;
+		return 0;
+	}
+
+	for (i = 1; i < r->npages; i++)
+		if (eeprom_kv_page_ok(r, (kv->active + i) % r->npages))
+			break;
+	kv->tail = (kv->active + i) % r->npages;
+	kv->used = (kv->active - kv->tail + r->npages) % r->npages + 1;
+	kv->gc_off = EEPROM_KV_AREA_START;
+	memcpy(kv->image, eeprom_cache_page(r->first + kv->active),
+	       EEPROM_PAGE_SIZE);
+
+	/*
+	 * Replay the records from the oldest page on; later ones win
+	 */
+	for (i = 0; i < kv->used; i++) {
+		n = (kv->tail + i) % r->npages;
+		if (!eeprom_kv_page_ok(r, n))
+			continue;
+		for (off = EEPROM_KV_AREA_START; off + 2 <= EEPROM_KV_AREA_END;
+		     off += eeprom_kv_rec_len(p)) {
+			p = eeprom_kv_rec(r, n, off);
+			if (!eeprom_kv_rec_ok(p, off))
+				break;
+			eeprom_kv_apply(r, n, off);
+		}
+		if (n == kv->active)
+			kv->fill = off;
+	}
+
+	return 0;
+}
+
+static int eeprom_kv_flush(struct eeprom_region *r, bool sync)
+{
+	struct eeprom_kv *kv = r->priv;
+	int ret;
+
+	if (!kv->dirty)
+		return 0;
+
+	kv->image[EEPROM_PAGE_WORDS - 1] =
+		eeprom_crc32(0, (const u8 *) kv->image, EEPROM_KV_AREA_END);
+	ret = eeprom_page_commit(r->first + kv->active, kv->image);
+	if (ret < 0)
+		return ret;
+	kv->dirty = false;
+	return 0;
+}
+
+static const struct eeprom_region_type eeprom_kv_type = {
+	.name = "kv",
+	.min_pages = 2,
+	.load = eeprom_kv_load,
+	.flush = eeprom_kv_flush,
+};
+
+/*
+ * Append a copy of a record to the active page
+ */
+static u16 eeprom_kv_append(struct eeprom_kv *kv, const u8 *rec, u16 len)
+{
+	u16 off = kv->fill;
+
+	memcpy((u8 *) kv->image + off, rec, len);
+	kv->fill += len;
+	kv->dirty = true;
+	return off;
+}
+
+/*
+ * One bounded garbage collection step: move the live records of the
+ * tail page that fit into the active page, and free the tail page
+ * once it is drained. Only RAM is touched here.
+ */
+static void eeprom_kv_gc(struct eeprom_region *r)
+{
+	struct eeprom_kv *kv = r->priv;
+	const u8 *p;
+	u16 i, len;
+
+	while (kv->used > 1 && r->npages - kv->used < EEPROM_KV_GC_FREE) {
+		if (eeprom_kv_page_ok(r, kv->tail)) {
+			for (; kv->gc_off + 2 <= EEPROM_KV_AREA_END;
+			     kv->gc_off += len) {
+				p = eeprom_kv_rec(r, kv->tail, kv->gc_off);
+				if (!eeprom_kv_rec_ok(p, kv->gc_off))
+					break;
+				len = eeprom_kv_rec_len(p);
+
+				/* Deletions in the oldest page shadow nothing */
+				i = eeprom_kv_lookup(r, p + 2, p[0]);
+				if (i == EEPROM_KV_NIL ||
+				    kv->ents[i].page != kv->tail ||
+				    kv->ents[i].off != kv->gc_off)
+					continue;
+
+				if (kv->fill + len > EEPROM_KV_AREA_END)
+					return;
+				kv->ents[i].page = kv->active;
+				kv->ents[i].off = eeprom_kv_append(kv, p, len);
+			}
+		}
+
+		kv->tail = (kv->tail + 1) % r->npages;
+		kv->used--;
+		kv->gc_off = EEPROM_KV_AREA_START;
+	}
+}
+
+static int eeprom_kv_get(struct eeprom_kv_rec *rec)
+{
+	struct eeprom_region *r = eeprom_region_find(&eeprom_kv_type,
+						     rec->region);
+	struct eeprom_kv *kv;
+	const u8 *p;
+	u16 i;
+
+	if (!r || rec->klen > EEPROM_KV_KEY_MAX)
+		return -EINVAL;
+	kv = r->priv;
+
+	i = eeprom_kv_lookup(r, rec->key, rec->klen);
+	if (i == EEPROM_KV_NIL)
+		return -ENOENT;
+
+	p = eeprom_kv_rec(r, kv->ents[i].page, kv->ents[i].off);
+	if (!eeprom_kv_rec_ok(p, kv->ents[i].off))
+		return -EIO;
+	rec->vlen = p[1];
+	memcpy(rec->value, p + 2 + p[0], p[1]);
+	return 0;
+}
+
+/*
+ * Store or delete a key
+ */
+static int eeprom_kv_put(struct eeprom_kv_rec *rec, bool del)
+{
+	struct eeprom_region *r = eeprom_region_find(&eeprom_kv_type,
+						     rec->region);
+	u8 buf[2 + EEPROM_KV_KEY_MAX + EEPROM_KV_VALUE_MAX];
+	struct eeprom_kv *kv;
+	u16 i, off, len;
+	int ret;
+
+	if (!r || !rec->klen || rec->klen > EEPROM_KV_KEY_MAX ||
+	    (!del && rec->vlen > EEPROM_KV_VALUE_MAX))
+		return -EINVAL;
+	kv = r->priv;
+
+	i = eeprom_kv_lookup(r, rec->key, rec->klen);
+	if (del && i == EEPROM_KV_NIL)
+		return -ENOENT;
+	if (!del && i == EEPROM_KV_NIL && kv->free == EEPROM_KV_NIL)
+		return -ENOSPC;
+
+	buf[0] = rec->klen;
+	buf[1] = del ? EEPROM_KV_DELETED : rec->vlen;
+	memcpy(buf + 2, rec->key, rec->klen);
+	len = 2 + rec->klen;
+	if (!del) {
+		memcpy(buf + len, rec->value, rec->vlen);
+		len += rec->vlen;
+	}
+
+	eeprom_kv_gc(r);
+
+	/*
+	 * Program the full active page and move on to the next free one
+	 */
+	if (kv->fill + len > EEPROM_KV_AREA_END) {
+		if (kv->used == r->npages)
+			return -ENOSPC;
+		ret = eeprom_kv_flush(r, true);
+		if (ret < 0)
+			return ret;
+		eeprom_kv_open_page(kv, (kv->active + 1) % r->npages);
+		kv->used++;
+	}
+
+	off = eeprom_kv_append(kv, buf, len);
+	if (del)
+		eeprom_kv_remove(kv, rec->key, rec->klen, i);
+	else if (i != EEPROM_KV_NIL) {
+		kv->ents[i].page = kv->active;
+		kv->ents[i].off = off;
+	} else
+		eeprom_kv_insert(kv, rec->key, rec->klen, kv->active, off);
+
+	return eeprom_region_dirty(r);
+}
+
+static int eeprom_kv_iter(struct eeprom_kv_rec *rec)
+{
+	struct eeprom_region *r = eeprom_region_find(&eeprom_kv_type,
+						     rec->region);
+	struct eeprom_kv *kv;
+	const u8 *p;
+	u32 i;
+
+	if (!r)
+		return -EINVAL;
+	kv = r->priv;
+
+	for (i = rec->cookie; i < kv->nents; i++) {
+		if (kv->ents[i].page == (EEPROM_KV_NIL & 0xff))
+			continue;
+
+		p = eeprom_kv_rec(r, kv->ents[i].page, kv->ents[i].off);
+		if (!eeprom_kv_rec_ok(p, kv->ents[i].off))
+			return -EIO;
+		rec->klen = p[0];
+		rec->vlen = p[1];
+		memcpy(rec->key, p + 2, p[0]);
+		memcpy(rec->value, p + 2 + p[0], p[1]);
+		rec->cookie = i + 1;
+		return 0;
+	}
+
+	return -ENOENT;
+}
+
+/*
+ * Time-series regions. Samples are packed into pages as varints: the
+ * first sample of a page as absolute values, every further one as the
+ * difference to its predecessor, with values zigzag-encoded so that
+ * small changes of either sign take a single byte. A page starts with
+ * a sequence number and the number of samples in it and ends with a
+ * CRC-32. Samples collect in a RAM image of the head page, which is
+ * only programmed once it is full (or on sync).
+ */
+#define EEPROM_TS_AREA_START		(sizeof(u32) + 1)
+#define EEPROM_TS_AREA_END		(EEPROM_PAGE_SIZE - sizeof(u32))
+#define EEPROM_TS_FIELDS_MAX		(1 + EEPROM_TS_CHANNELS_MAX)
+
+struct eeprom_ts {
+	u32 image[EEPROM_PAGE_WORDS];
+	u32 prev[EEPROM_TS_FIELDS_MAX];
+	u32 next_seq;
+	u16 head;
+	u16 fill;
+	bool dirty;
+};
+
+static inline u32 eeprom_zigzag(u32 v)
+{
+	return (v << 1) ^ (u32)((s32) v >> 31);
+}
+
+static inline u32 eeprom_unzigzag(u32 v)
+{
+	return (v >> 1) ^ -(v & 1);
+}
+
+/*
+ * Encode a sample into p, as a delta to prev unless it starts a page
+ */
+static u16 eeprom_ts_encode(u8 *p, const u32 *prev, const u32 *cur,
+			    int nfields, bool first)
+{
+	u16 len = 0;
+	u32 v;
+	int i;
+
+	for (i = 0; i < nfields; i++) {
+		v = first ? cur[i] : cur[i] - prev[i];
+		if (i)
+			v = eeprom_zigzag(v);
+		do {
+			p[len++] = (v & 0x7f) | (v > 0x7f ? 0x80 : 0);
+			v >>= 7;
+		} while (v);
+	}
+	return len;
+}
+
+/*
+ * Decode the sample at *off of a page into cur, which holds the
+ * previous sample on entry
+ */
+static int eeprom_ts_decode(const u8 *page, u16 *off, u32 *cur,
+			    int nfields, bool first)
+{
+	u32 v;
+	int i, shift;
+
+	for (i = 0; i < nfields; i++) {
+		v = 0;
+		shift = 0;
+		do {
+			if (*off >= EEPROM_TS_AREA_END || shift > 28)
+				return -EBADMSG;
+			v |= (u32)(page[*off] & 0x7f) << shift;
+			shift += 7;
+		} while (page[(*off)++] & 0x80);
+
+		if (i)
+			v = eeprom_unzigzag(v);
+		cur[i] = first ? v : cur[i] + v;
+	}
+	return 0;
+}
+
+static inline int eeprom_ts_fields(struct eeprom_region *r)
+{
+	return 1 + r->arg;
+}
+
+/*
+ * Get a page of a ts region, or NULL if it holds no valid samples
+ */
+static const u8 *eeprom_ts_page(struct eeprom_region *r, u16 i)
+{
+	struct eeprom_ts *ts = r->priv;
+	const u32 *page;
+
+	if (ts && i == ts->head)
+		return (const u8 *) ts->image;
+
+	eeprom_cache_fill(r->first + i);
+	page = eeprom_cache_page(r->first + i);
+	if (!page[0] || page[EEPROM_PAGE_WORDS - 1] !=
+	    eeprom_crc32(0, (const u8 *) page, EEPROM_TS_AREA_END))
+		return NULL;
+	return (const u8 *) page;
+}
+
+/*
+ * Start a new, empty head page
+ */
+static void eeprom_ts_open_page(struct eeprom_ts *ts, u16 page)
+{
+	memset(ts->image, 0, sizeof(ts->image));
+	ts->image[0] = ts->next_seq++;
+	ts->head = page;
+	ts->fill = EEPROM_TS_AREA_START;
+}
+
+static int eeprom_ts_load(struct eeprom_region *r)
+{
+	struct eeprom_ts *ts;
+	const u8 *p;
+	u32 seq, best = 0;
+	u16 i, head = 0;
+	int n;
+
+	if (r->arg < 1 || r->arg > EEPROM_TS_CHANNELS_MAX)
+		return -EINVAL;
+
+	ts = kzalloc(sizeof(*ts), GFP_KERNEL);
+	if (!ts)
+		return -ENOMEM;
+
+	for (i = 0; i < r->npages; i++) {
+		p = eeprom_ts_page(r, i);
+		if (!p)
+			continue;
+		memcpy(&seq, p, sizeof(seq));
+		if (seq > best) {
+			best = seq;
+			head = i;
+		}
+	}
+
+	ts->next_seq = best + 1;
+	if (!best) {
+		eeprom_ts_open_page(ts, 0);
+		r->priv = ts;
+		return 0;
+	}
+
+	/*
+	 * Keep filling the head page where it was left off
+	 */
+	p = eeprom_ts_page(r, head);
+	memcpy(ts->image, p, EEPROM_PAGE_SIZE);
+	ts->head = head;
+	ts->fill = EEPROM_TS_AREA_START;
+	for (n = 0; n < p[sizeof(u32)]; n++)
+		if (eeprom_ts_decode(p, &ts->fill, ts->prev,
+				     eeprom_ts_fields(r), !n))
+			break;
+	((u8 *) ts->image)[sizeof(u32)] = n;
+	r->priv = ts;
+
+	return 0;
+}
+
+static int eeprom_ts_flush(struct eeprom_region *r, bool sync)
+{
+	struct eeprom_ts *ts = r->priv;
+	int ret;
+
+	if (!sync || !ts->dirty)
+		return 0;
+
+	ts->image[EEPROM_PAGE_WORDS - 1] =
+		eeprom_crc32(0, (const u8 *) ts->image, EEPROM_TS_AREA_END);
+	ret = eeprom_page_commit(r->first + ts->head, ts->image);
+	if (ret < 0)
+		return ret;
+	ts->dirty = false;
+	return 0;
+}
+
+static const struct eeprom_region_type eeprom_ts_type = {
+	.name = "ts",
+	.has_arg = true,
+	.load = eeprom_ts_load,
+	.flush = eeprom_ts_flush,
+};
+
+static int eeprom_ts_append(struct eeprom_ts_append *a)
+{
+	struct eeprom_region *r = eeprom_region_find(&eeprom_ts_type,
+						     a->region);
+	u8 buf[EEPROM_TS_FIELDS_MAX * 5];
+	u32 cur[EEPROM_TS_FIELDS_MAX];
+	struct eeprom_ts *ts;
+	u8 *count;
+	u16 len;
+	int ret;
+
+	if (!r)
+		return -EINVAL;
+	ts = r->priv;
+
+	cur[0] = a->sample.time;
+	memcpy(cur + 1, a->sample.value, r->arg * sizeof(u32));
+
+	count = (u8 *) ts->image + sizeof(u32);
+	len = eeprom_ts_encode(buf, ts->prev, cur, eeprom_ts_fields(r), !*count);
+
+	/*
+	 * Program the full page and start the next one, dropping the
+	 * oldest page; the sample then starts the new page
+	 */
+	if (ts->fill + len > EEPROM_TS_AREA_END) {
+		ts->dirty = true;
+		ret = eeprom_ts_flush(r, true);
+		if (ret < 0)
+			return ret;
+		eeprom_ts_open_page(ts, (ts->head + 1) % r->npages);
+		len = eeprom_ts_encode(buf, ts->prev, cur,
+				       eeprom_ts_fields(r), true);
+	}
+
+	memcpy((u8 *) ts->image + ts->fill, buf, len);
+	ts->fill += len;
+	(*count)++;
+	memcpy(ts->prev, cur, sizeof(cur));
+	ts->dirty = true;
+
+	return 0;
+}
+
+/*
+ * Stream samples out, decoding the pages from the oldest on. The
+ * cursor is the sequence number of a page and the index of a sample
+ * within it.
+ */
+static int eeprom_ts_read(struct eeprom_ts_read *rd)
+{
+	struct eeprom_region *r = eeprom_region_find(&eeprom_ts_type,
+						     rd->region);
+	struct eeprom_ts_sample __user *buf =
+		(struct eeprom_ts_sample __user *)(unsigned long) rd->buf;
+	struct eeprom_ts_sample sample;
+	u32 cur[EEPROM_TS_FIELDS_MAX];
+	u32 seq, count = 0;
+	struct eeprom_ts *ts;
+	const u8 *p;
+	u16 i, k, n, off;
+	u64 pos;
+
+	if (!r)
+		return -EINVAL;
+	ts = r->priv;
+
+	memset(&sample, 0, sizeof(sample));
+	for (n = 0; n < r->npages && count < rd->count; n++) {
+		i = (ts->head + 1 + n) % r->npages;
+		p = eeprom_ts_page(r, i);
+		if (!p)
+			continue;
+		memcpy(&seq, p, sizeof(seq));
+
+		off = EEPROM_TS_AREA_START;
+		for (k = 0; k < p[sizeof(u32)] && count < rd->count; k++) {
+			if (eeprom_ts_decode(p, &off, cur, eeprom_ts_fields(r), !k))
+				break;
+
+			pos = ((u64) seq << 8) | k;
+			if (pos < rd->cursor)
+				continue;
+
+			sample.time = cur[0];
+			memcpy(sample.value, cur + 1, r->arg * sizeof(u32));
+			if (copy_to_user(buf + count, &sample, sizeof(sample)))
+				return -EFAULT;
+			count++;
+			rd->cursor = pos + 1;
+		}
+	}
+	rd->count = count;
+
+	return 0;
+}
+
+/*
+ * Flags regions. The pages of the region are plain bit arrays. Updates
+ * are merged into a RAM copy of the region, which also serves all
+ * tests, and each changed page is programmed once per write-back.
+ */
+struct eeprom_flagset {
+	DECLARE_BITMAP(dirty, EEPROM_PAGE_NUM);
+	u32 words[0];
+};
+
+static int eeprom_flags_load(struct eeprom_region *r)
+{
+	struct eeprom_flagset *f;
+	u16 i;
+
+	f = kzalloc(sizeof(*f) + r->npages * EEPROM_PAGE_SIZE, GFP_KERNEL);
+	if (!f)
+		return -ENOMEM;
+
+	for (i = 0; i < r->npages; i++) {
+		eeprom_cache_fill(r->first + i);
+		memcpy(&f->words[i * EEPROM_PAGE_WORDS],
+		       eeprom_cache_page(r->first + i), EEPROM_PAGE_SIZE);
+	}
+	r->priv = f;
+
+	return 0;
+}
+
+static int eeprom_flags_flush(struct eeprom_region *r, bool sync)
+{
+	struct eeprom_flagset *f = r->priv;
+	int i, err, ret = 0;
+
+	for_each_set_bit(i, f->dirty, r->npages) {
+		err = eeprom_page_commit(r->first + i,
+					 &f->words[i * EEPROM_PAGE_WORDS]);
+		if (err < 0) {
+			ret = err;
+			continue;
+		}
+		__clear_bit(i, f->dirty);
+	}
+	return ret;
+}
+
+static const struct eeprom_region_type eeprom_flags_type = {
+	.name = "flags",
+	.load = eeprom_flags_load,
+	.flush = eeprom_flags_flush,
+};
+
+/*
+ * Set, clear or test a batch of flag words
+ */
+static int eeprom_flags_op(unsigned int cmd, struct eeprom_flags *fl)
+{
+	struct eeprom_region *r = eeprom_region_find(&eeprom_flags_type,
+						     fl->region);
+	u32 __user *masks = (u32 __user *)(unsigned long) fl->masks;
+	u32 chunk[EEPROM_PAGE_WORDS];
+	struct eeprom_flagset *f;
+	u32 i, n, done, w, old;
+	bool dirty = false;
+
+	if (!r || fl->word > r->npages * EEPROM_PAGE_WORDS ||
+	    fl->nwords > r->npages * EEPROM_PAGE_WORDS - fl->word)
+		return -EINVAL;
+	f = r->priv;
+
+	for (done = 0; done < fl->nwords; done += n, masks += n) {
+		n = min_t(u32, fl->nwords - done, EEPROM_PAGE_WORDS);
+		if (copy_from_user(chunk, masks, n * sizeof(u32)))
+			return -EFAULT;
+
+		for (i = 0; i < n; i++) {
+			w = fl->word + done + i;
+			old = f->words[w];
+
+			switch (cmd) {
+			case EEPROM_IOC_FLAGS_SET:
+				f->words[w] |= chunk[i];
+				break;
+			case EEPROM_IOC_FLAGS_CLEAR:
+				f->words[w] &= ~chunk[i];
+				break;
+			default:
+				chunk[i] &= old;
+				break;
+			}
+
+			if (f->words[w] != old) {
+				__set_bit(w / EEPROM_PAGE_WORDS, f->dirty);
+				dirty = true;
+			}
+		}
+
+		if (cmd == EEPROM_IOC_FLAGS_TEST &&
+		    copy_to_user(masks, chunk, n * sizeof(u32)))
+			return -EFAULT;
+	}
+
+	if (dirty)
+		return eeprom_region_dirty(r);
+	return 0;
+}
+
+/*
+ * Region types that may appear in eeprom_layout
+ */
+static const struct eeprom_region_type *eeprom_region_types[] = {
+	&eeprom_counter_type,
+	&eeprom_log_type,
+	&eeprom_kv_type,
+	&eeprom_ts_type,
+	&eeprom_flags_type,
+};
+
+/*
+ * Parse eeprom_layout into eeprom_regions
+ */
+static int __init eeprom_layout_parse(void)
+{
+	DECLARE_BITMAP(used, EEPROM_PAGE_NUM);
+	const struct eeprom_region_type *type;
+	struct eeprom_region *r;
+	unsigned long first, last, arg;
+	char *buf, *p, *tok, *name;
+	bool has_arg;
+	int i, ret = 0;
+
+	if (!eeprom_layout || !*eeprom_layout)
+		return 0;
+
+	buf = kstrdup(eeprom_layout, GFP_KERNEL);
+	if (!buf)
+		return -ENOMEM;
+
+	bitmap_zero(used, EEPROM_PAGE_NUM);
+	for (p = buf; (tok = strsep(&p, ",")) != NULL; ) {
+		if (!*tok)
+			continue;
+
+		name = strsep(&tok, ":");
+		if (!tok)
+			goto Invalid;
+
+		first = simple_strtoul(tok, &tok, 10);
+		last = first;
+		arg = 0;
+		if (*tok == '-')
+			last = simple_strtoul(tok + 1, &tok, 10);
+		has_arg = *tok == '/';
+		if (has_arg)
+			arg = simple_strtoul(tok + 1, &tok, 10);
+		if (*tok || first > last || last >= eeprom_pages)
+			goto Invalid;
+
+		type = NULL;
+		for (i = 0; i < ARRAY_SIZE(eeprom_region_types); i++)
+			if (!strcmp(name, eeprom_region_types[i]->name))
+				type = eeprom_region_types[i];
+		if (!type || eeprom_region_num == EEPROM_REGION_MAX)
+			goto Invalid;
+		if (has_arg != type->has_arg ||
+		    last - first + 1 < type->min_pages)
+			goto Invalid;
+
+		for (i = first; i <= last; i++) {
+			if (test_bit(i, used))
+				goto Invalid;
+			__set_bit(i, used);
+		}
+
+		r = &eeprom_regions[eeprom_region_num++];
+		r->type = type;
+		r->first = first;
+		r->npages = last - first + 1;
+		r->arg = arg;
+	}
+	goto Done;
+
+Invalid:
+	printk(KERN_ALERT "%s: invalid eeprom_layout \"%s\"\n",
+	       __func__, eeprom_layout);
+	eeprom_region_num = 0;
+	ret = -EINVAL;
+Done:
+	kfree(buf);
+	return ret;
+}
+
+/*
+ * Set up the regions of the layout from what the EEPROM holds
+ */
+static int __init eeprom_regions_init(void)
+{
+	int i, ret;
+
+	ret = eeprom_layout_parse();
+	if (ret)
+		return ret;
+
+	eeprom_op_begin();
+	for (i = 0; i < eeprom_region_num; i++) {
+		ret = eeprom_regions[i].type->load(&eeprom_regions[i]);
+		if (ret) {
+			eeprom_region_num = i;
+			break;
+		}
+		d_printk(1, "region %s:%d-%d\n", eeprom_regions[i].type->name,
+			 eeprom_regions[i].first,
+			 eeprom_regions[i].first + eeprom_regions[i].npages - 1);
+	}
+	eeprom_op_end();
+
+	return ret;
+}
+
+/*
+ * Write back and release all regions
+ */
+static void eeprom_regions_cleanup(void)
+{
+	int i;
+
+	cancel_delayed_work_sync(&eeprom_flush_work);
+
+	eeprom_op_begin();
+	if (eeprom_regions_flush(true) < 0)
+		printk(KERN_ERR "%s: region state lost\n", __func__);
+	if (eeprom_ecc_sync() < 0)
+		printk(KERN_ERR "%s: error correction codes lost\n", __func__);
+	for (i = 0; i < eeprom_region_num; i++) {
+		kfree(eeprom_regions[i].priv);
+		eeprom_regions[i].priv = NULL;
+	}
+	eeprom_region_num = 0;
+	eeprom_op_end();
+
+	/*
+	 * Codes that failed to sync above have the write-back scheduled
+	 * again by eeprom_op_end(); they are lost either way
+	 */
+	cancel_delayed_work_sync(&eeprom_flush_work);
+}
+
+/*
+ * Device open
+ */
+static int eeprom_open(struct inode *inode, struct file *file)
+{
+	int ret = 0;
+
+	/*
+	 * One process at a time
+	 */
+	if (eeprom_lock ++ > 0) {
+		ret = -EBUSY;
+		goto Done;
+	}
+ 
+	/*
+ 	 * Increment the module use counter
+ 	 */
+	try_module_get(THIS_MODULE);
+
+Done:
+	d_printk(2, "lock=%d\n", eeprom_lock);
+	return ret;
+}
+
+/*
+ * Device close
+ */
+static int eeprom_release(struct inode *inode, struct file *file)
+{
+	/*
+ 	 * Release device
+ 	 */
+	eeprom_lock = 0;
+
+	/*
+ 	 * Decrement module use counter
+ 	 */
+	module_put(THIS_MODULE);
+
+	d_printk(2, "lock=%d\n", eeprom_lock);
+	return 0;
+}
+
+loff_t eeprom_llseek(struct file *filp, loff_t offset, int whence)
+{
+    loff_t newpos;
+
+	switch (whence) {
+	case SEEK_SET:
+		newpos = offset;
+		break;
+	
+	case SEEK_CUR:
+        newpos = filp->f_pos + offset;
+		break;
+
+    case SEEK_END:
+        newpos = EEPROM_USER_SIZE + offset;
+        break;
+
+    default:
+        return -EINVAL;
+    }
+
+    if (newpos < 0) return -EINVAL;
+    filp->f_pos = newpos;
+    return newpos;
+}
+
+/* 
+ * Device read
+ */
+static ssize_t eeprom_read(struct file *filp, char *buffer,
+			 size_t length, loff_t * offset)
+{
+	int ret = 0;
+	size_t remaining, to_read, read_bytes, page_offset;
+	struct eeprom_lat lat;
+	loff_t pos = *offset;
+	ktime_t t = eeprom_trace_start(eeprom_read_exit);
+	u64 rt = eeprom_rec_start(EEPROM_REC_SYSCALLS);
+    u16 page;
+
+	trace_eeprom_read_enter(pos, length);
+	eeprom_lat_start(&lat);
+
+	/*
+ 	 * Check that the user has supplied a valid buffer
+ 	 */
+	if (! access_ok(0, buffer, length)) {
+		ret = -EINVAL;
+		goto Done;
+	}
+
+    /* EEPROM has a fixed size. May not go beyond end */
+    remaining = *offset < EEPROM_USER_SIZE ? EEPROM_USER_SIZE - *offset : 0;
+    if (length > remaining)
+		length = remaining;
+
+    /* return EOF condition if all was read */
+    if (length == 0) {
+		ret = 0;
+		goto Done;
+	}
+
+	eeprom_stat_inc(reads);
+	eeprom_op_begin_lat(&lat);
+	for (to_read = length; to_read > 0; to_read -= read_bytes) {
+		page = *offset >> 6; 
+		page_offset = *offset & (EEPROM_PAGE_SIZE-1);
+        
+		if (to_read > (EEPROM_PAGE_SIZE - page_offset))
+			read_bytes = EEPROM_PAGE_SIZE - page_offset; 
+        else
+			read_bytes = to_read;
+			
+		eeprom_cache_fill(page);
+		if (copy_to_user(buffer, eeprom_cache_ptr(*offset), read_bytes)) {
+			ret = -EFAULT;
+			goto Unlock;
+		}
+		*offset += read_bytes;
+		buffer += read_bytes;
+    } 
+
+	eeprom_stat_add(read_bytes, length);
+	ret = length;
+Unlock:
+	eeprom_op_end_lat(&lat);
+	eeprom_lat_record(EEPROM_LAT_READ, &lat);
+Done:
+	trace_eeprom_read_exit(pos, length, ret, t);
+	eeprom_rec_add(EEPROM_REC_SYSCALLS, EEPROM_REC_READ, pos, length,
+		       pos >> 6, ret, rt);
+	d_printk(3, "length=%d,ret=%d\n", length, ret);
+	return ret;
+}
+
+/* 
+ * Device write
+ */
+static ssize_t eeprom_write(struct file *filp, const char *buffer,
+			  size_t length, loff_t * offset)
+{
+	int ret = 0;
+	size_t remaining, to_write, write_bytes, page_offset;
+	u32 image[EEPROM_PAGE_WORDS];
+	struct eeprom_lat lat;
+	loff_t pos = *offset;
+	ktime_t t = eeprom_trace_start(eeprom_write_exit);
+	u64 rt = eeprom_rec_start(EEPROM_REC_SYSCALLS);
+    u16 page;
+
+	trace_eeprom_write_enter(pos, length);
+	eeprom_lat_start(&lat);
+
+	/*
+	* Check that the user has supplied a valid buffer
+	*/
+	if (! access_ok(0, buffer, length)) {
+		ret = -EINVAL;
+		goto Done;
+	}
+
+    /* EEPROM has a fixed size. May not go beyond end */
+    remaining = *offset < EEPROM_USER_SIZE ? EEPROM_USER_SIZE - *offset : 0;
+    if (length > remaining)
+		length = remaining;
+
+    /* return EOF condition if all was read */
+    if (length == 0) {
+		ret = 0;
+		goto Done;
+	}
+
+	eeprom_stat_inc(writes);
+	eeprom_op_begin_lat(&lat);
+	for (to_write = length; to_write > 0; to_write -= write_bytes) {
+		page = *offset >> 6; 
+		page_offset = *offset & (EEPROM_PAGE_SIZE-1);
+        
+		if (to_write > (EEPROM_PAGE_SIZE - page_offset))
+			write_bytes = EEPROM_PAGE_SIZE - page_offset; 
+        else
+			write_bytes = to_write;
+			
+		/* Merge the new bytes into the cached page image */
+		eeprom_cache_fill(page);
+		memcpy(image, eeprom_cache_page(page), EEPROM_PAGE_SIZE);
+		if (copy_from_user((u8 *) image + page_offset, buffer,
+				   write_bytes)) {
+			ret = -EFAULT;
+			goto Unlock;
+		}
+		ret = eeprom_page_commit(page, image);
+		if (ret < 0)
+			goto Unlock;
+		*offset += write_bytes;
+		buffer += write_bytes;
+    } 
+    
+	eeprom_stat_add(write_bytes, length);
+	ret = length;
+
+Unlock:
+	eeprom_op_end_lat(&lat);
+	eeprom_lat_record(EEPROM_LAT_WRITE, &lat);
+Done:
+	trace_eeprom_write_exit(pos, length, ret, t);
+	eeprom_rec_add(EEPROM_REC_SYSCALLS, EEPROM_REC_WRITE, pos, length,
+		       pos >> 6, ret, rt);
+	d_printk(3, "length=%d\n", length);
+	return ret;
+}
+
+/*
+ * Device ioctl
+ */
+static long eeprom_ioctl(struct file *filp, unsigned int cmd,
+			 unsigned long arg)
+{
+	void __user *argp = (void __user *) arg;
+	union {
+		struct eeprom_copy copy;
+		struct eeprom_fill fill;
+		struct eeprom_crc crc;
+		struct eeprom_cmp cmp;
+		struct eeprom_cas cas;
+		struct eeprom_counter ctr;
+		struct eeprom_log_rec log;
+		struct eeprom_kv_rec kv;
+		struct eeprom_ts_append ts_append;
+		struct eeprom_ts_read ts_read;
+		struct eeprom_flags flags;
+		struct eeprom_ecc_stats ecc;
+		struct eeprom_verify_stats verify;
+	} u;
+	u64 t = eeprom_rec_start(EEPROM_REC_SYSCALLS);
+	long ret;
+
+	if (_IOC_TYPE(cmd) != EEPROM_IOC_MAGIC || _IOC_SIZE(cmd) > sizeof(u)) {
+		ret = -ENOTTY;
+		goto Done;
+	}
+
+	/*
+	 * Commands that pass data in get their argument copied here
+	 */
+	if ((_IOC_DIR(cmd) & _IOC_WRITE) &&
+	    copy_from_user(&u, argp, _IOC_SIZE(cmd))) {
+		ret = -EFAULT;
+		goto Done;
+	}
+
+	eeprom_op_begin();
+	switch (cmd) {
+	case EEPROM_IOC_COPY:
+		if (!(filp->f_mode & FMODE_WRITE)) {
+			ret = -EBADF;
+			break;
+		}
+		ret = eeprom_copy(&u.copy);
+		break;
+
+	case EEPROM_IOC_FILL:
+		if (!(filp->f_mode & FMODE_WRITE)) {
+			ret = -EBADF;
+			break;
+		}
+		ret = eeprom_fill(&u.fill);
+		break;
+
+	case EEPROM_IOC_CRC:
+		ret = eeprom_crc(&u.crc);
+		break;
+
+	case EEPROM_IOC_CMP:
+		ret = eeprom_cmp(&u.cmp);
+		break;
+
+	case EEPROM_IOC_CAS:
+		if (!(filp->f_mode & FMODE_WRITE)) {
+			ret = -EBADF;
+			break;
+		}
+		ret = eeprom_cas(&u.cas);
+		break;
+
+	case EEPROM_IOC_CTR_ADD:
+	case EEPROM_IOC_CTR_SET:
+		if (!(filp->f_mode & FMODE_WRITE)) {
+			ret = -EBADF;
+			break;
+		}
+		/* fall through */
+	case EEPROM_IOC_CTR_GET:
+		ret = eeprom_counter_op(cmd, &u.ctr);
+		break;
+
+	case EEPROM_IOC_LOG_APPEND:
+		if (!(filp->f_mode & FMODE_WRITE)) {
+			ret = -EBADF;
+			break;
+		}
+		ret = eeprom_log_append(&u.log);
+		break;
+
+	case EEPROM_IOC_LOG_READ:
+		ret = eeprom_log_read(&u.log);
+		break;
+
+	case EEPROM_IOC_KV_GET:
+		ret = eeprom_kv_get(&u.kv);
+		break;
+
+	case EEPROM_IOC_KV_PUT:
+	case EEPROM_IOC_KV_DEL:
+		if (!(filp->f_mode & FMODE_WRITE)) {
+			ret = -EBADF;
+			break;
+		}
+		ret = eeprom_kv_put(&u.kv, cmd == EEPROM_IOC_KV_DEL);
+		break;
+
+	case EEPROM_IOC_KV_ITER:
+		ret = eeprom_kv_iter(&u.kv);
+		break;
+
+	case EEPROM_IOC_TS_APPEND:
+		if (!(filp->f_mode & FMODE_WRITE)) {
+			ret = -EBADF;
+			break;
+		}
+		ret = eeprom_ts_append(&u.ts_append);
+		break;
+
+	case EEPROM_IOC_TS_READ:
+		ret = eeprom_ts_read(&u.ts_read);
+		break;
+
+	case EEPROM_IOC_FLAGS_SET:
+	case EEPROM_IOC_FLAGS_CLEAR:
+		if (!(filp->f_mode & FMODE_WRITE)) {
+			ret = -EBADF;
+			break;
+		}
+		/* fall through */
+	case EEPROM_IOC_FLAGS_TEST:
+		ret = eeprom_flags_op(cmd, &u.flags);
+		break;
+
+	case EEPROM_IOC_ECC_STATS:
+		u.ecc.corrected = eeprom_ecc_corrected;
+		u.ecc.uncorrectable = eeprom_ecc_uncorrectable;
+		ret = 0;
+		break;
+
+	case EEPROM_IOC_VERIFY_STATS:
+		BUILD_BUG_ON(EEPROM_VERIFY_PAGES != EEPROM_PAGE_NUM);
+		memcpy(u.verify.failures, eeprom_verify_failures,
+		       sizeof(u.verify.failures));
+		ret = 0;
+		break;
+
+	case EEPROM_IOC_SYNC:
+		ret = eeprom_regions_flush(true);
+		if (!ret)
+			ret = eeprom_ecc_sync();
+		break;
+
+	default:
+		ret = -ENOTTY;
+		break;
+	}
+	eeprom_op_end();
+
+	/*
+	 * Commands that pass data out get their argument copied back
+	 */
+	if (ret >= 0 && (_IOC_DIR(cmd) & _IOC_READ) &&
+	    copy_to_user(argp, &u, _IOC_SIZE(cmd)))
+		ret = -EFAULT;
+
+Done:
+	eeprom_rec_add(EEPROM_REC_SYSCALLS, EEPROM_REC_IOCTL, cmd,
+		       _IOC_SIZE(cmd), 0, ret, t);
+	d_printk(3, "cmd=%x,ret=%ld\n", cmd, ret);
+	return ret;
+}
+
+/*
+ * PCLK the ram and file backends work out the controller timing from
+ */
+#define EEPROM_EMU_PCLK			60000000
+
+static struct file *eeprom_backend_filp;
+
+static u64 eeprom_backend_clock(void)
+{
+	return ktime_to_ns(ktime_get());
+}
+
+static ssize_t eeprom_backend_io(bool write, void *buf, size_t len,
+				 loff_t pos)
+{
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(4, 14, 0)
+	return write ? kernel_write(eeprom_backend_filp, buf, len, &pos) :
+		kernel_read(eeprom_backend_filp, buf, len, &pos);
+#else
+	mm_segment_t fs = get_fs();
+	ssize_t ret;
+
+	set_fs(KERNEL_DS);
+	if (write)
+		ret = vfs_write(eeprom_backend_filp,
+				(const char __user *) buf, len, &pos);
+	else
+		ret = vfs_read(eeprom_backend_filp,
+			       (char __user *) buf, len, &pos);
+	set_fs(fs);
+	return ret;
+#endif
+}
+
+/*
+ * Write a page through to the image of the file backend
+ */
+static void eeprom_backend_programmed(u32 page)
+{
+	ssize_t ret;
+
+	ret = eeprom_backend_io(true, &eeprom_sim_flash[page * EEPROM_PAGE_SIZE],
+				EEPROM_PAGE_SIZE, page * EEPROM_PAGE_SIZE);
+	if (ret != EEPROM_PAGE_SIZE)
+		printk(KERN_ERR "%s: writing page %d to %s failed with %zd\n",
+		       __func__, page, eeprom_file, ret);
+}
+
+/*
+ * Set up the backend and return the PCLK rate to time the controller
+ * from. An image shorter than the array leaves the rest blank.
+ */
+static int __init eeprom_backend_init(u32 *pclk)
+{
+	ssize_t len;
+	int ret = 0;
+
+	if (!strcmp(eeprom_backend, "hw")) {
+#ifdef CONFIG_ARCH_LPC178X
+		*pclk = lpc178x_clock_get(CLOCK_PCLK);
+#else
+		printk(KERN_ALERT "%s: no EEPROM controller on this machine\n",
+		       __func__);
+		ret = -ENODEV;
+#endif
+		goto Done;
+	}
+	if (strcmp(eeprom_backend, "ram") && strcmp(eeprom_backend, "file")) {
+		printk(KERN_ALERT "%s: unknown backend %s\n",
+		       __func__, eeprom_backend);
+		ret = -EINVAL;
+		goto Done;
+	}
+
+	*pclk = EEPROM_EMU_PCLK;
+	eeprom_sim_reset(*pclk);
+	eeprom_sim_prog_ns = (u64) eeprom_prog_us * NSEC_PER_USEC;
+	eeprom_sim_endurance = eeprom_endurance;
+	eeprom_sim_clock = eeprom_backend_clock;
+
+	if (!strcmp(eeprom_backend, "file")) {
+		eeprom_backend_filp = filp_open(eeprom_file, O_RDWR | O_CREAT,
+						S_IRUSR | S_IWUSR);
+		if (IS_ERR(eeprom_backend_filp)) {
+			ret = PTR_ERR(eeprom_backend_filp);
+			eeprom_backend_filp = NULL;
+			printk(KERN_ALERT "%s: opening %s failed with %d\n",
+			       __func__, eeprom_file, ret);
+			goto Done;
+		}
+		len = eeprom_backend_io(false, eeprom_sim_flash, EEPROM_SIZE, 0);
+		if (len < 0) {
+			ret = len;
+			printk(KERN_ALERT "%s: reading %s failed with %d\n",
+			       __func__, eeprom_file, ret);
+			filp_close(eeprom_backend_filp, NULL);
+			eeprom_backend_filp = NULL;
+			goto Done;
+		}
+		eeprom_sim_programmed = eeprom_backend_programmed;
+	}
+	eeprom_hw_emulated = 1;
+
+Done:
+	return ret;
+}
+
+static void eeprom_backend_cleanup(void)
+{
+	if (eeprom_backend_filp) {
+		eeprom_sim_programmed = NULL;
+		filp_close(eeprom_backend_filp, NULL);
+		eeprom_backend_filp = NULL;
+	}
+}
+
+/*
+ * The controller timing follows the PCLK rate. Code that changes PCLK
+ * calls eeprom_clock_changed() before raising the rate and after
+ * lowering it, so that the timing is legal all along; with cpufreq the
+ * transition notifier does the same for CPU frequency changes, which
+ * PCLK is divided from. The timing is set with eeprom_mutex held, so
+ * never under a command in progress.
+ */
+static u32 eeprom_pclk;
+
+static u32 eeprom_clock_rate(void)
+{
+#ifdef CONFIG_ARCH_LPC178X
+	if (!eeprom_hw_emulated)
+		return lpc178x_clock_get(CLOCK_PCLK);
+#endif
+	return eeprom_pclk;
+}
+
+/*
+ * Set the timing up for a new PCLK rate, or with pclk 0 for the rate
+ * the clock driver reports
+ */
+int eeprom_clock_changed(u32 pclk)
+{
+	if (!pclk)
+		pclk = eeprom_clock_rate();
+	if (!pclk)
+		return -EINVAL;
+
+	eeprom_op_begin();
+	if (pclk != eeprom_pclk) {
+		if (eeprom_hw_emulated)
+			eeprom_sim_set_pclk(pclk);
+		EEPROM_SetClock(pclk);
+		eeprom_pclk = pclk;
+		eeprom_stat_inc(clock_changes);
+		trace_eeprom_cmd_init(pclk, EEPROM_GetClkDiv(),
+				      EEPROM_GetWaitState());
+		d_printk(2, "pclk=%u,clkdiv=%u,wstate=%x\n", pclk,
+			 EEPROM_GetClkDiv(), EEPROM_GetWaitState());
+	}
+	eeprom_op_end();
+
+	return 0;
+}
+EXPORT_SYMBOL(eeprom_clock_changed);
+
+#ifdef CONFIG_CPU_FREQ
+/*
+ * PCLK scales with the CPU clock. The new rate is worked out from the
+ * ratio, rounded up so that the timing errs on the slow side.
+ */
+static int eeprom_cpufreq_fn(struct notifier_block *nb, unsigned long val,
+			     void *data)
+{
+	struct cpufreq_freqs *freqs = data;
+	u32 pclk;
+
+	if (eeprom_hw_emulated || !freqs->old || freqs->new == freqs->old)
+		return NOTIFY_DONE;
+	if (val == CPUFREQ_PRECHANGE && freqs->new < freqs->old)
+		return NOTIFY_DONE;
+	if (val == CPUFREQ_POSTCHANGE && freqs->new > freqs->old)
+		return NOTIFY_DONE;
+	if (val != CPUFREQ_PRECHANGE && val != CPUFREQ_POSTCHANGE)
+		return NOTIFY_DONE;
+
+	pclk = div_u64((u64) eeprom_pclk * freqs->new + freqs->old - 1,
+		       freqs->old);
+	eeprom_clock_changed(pclk);
+	return NOTIFY_OK;
+}
+
+static struct notifier_block eeprom_cpufreq_nb = {
+	.notifier_call = eeprom_cpufreq_fn
+};
+#endif
+
+/*
+ * Device operations
+ */
+/*
+ * debugfs interface. <debugfs>/eeprom/stats shows the statistics;
+ * writing anything to it clears them.
+ */
+static struct dentry *eeprom_debugfs;
+
+static const char *const eeprom_stat_names[] = {
+	"reads", "writes", "read_bytes", "write_bytes", "programs",
+	"programs_skipped", "cache_hits", "cache_misses", "lock_contended",
+	"powerdowns", "wakeups", "clock_changes"
+};
+
+static int eeprom_stats_show(struct seq_file *m, void *v)
+{
+	unsigned long sum[ARRAY_SIZE(eeprom_stat_names)] = { 0 };
+	unsigned long *st;
+	int cpu, i;
+
+	BUILD_BUG_ON(sizeof(sum) != sizeof(struct eeprom_stats));
+
+	for_each_possible_cpu(cpu) {
+		st = (unsigned long *) &per_cpu(eeprom_stats, cpu);
+		for (i = 0; i < ARRAY_SIZE(sum); i++)
+			sum[i] += st[i];
+	}
+	for (i = 0; i < ARRAY_SIZE(sum); i++)
+		seq_printf(m, "%-16s %lu\n", eeprom_stat_names[i], sum[i]);
+	seq_printf(m, "%-16s %lu\n", "poll_loops", eeprom_hw_polls);
+	return 0;
+}
+
+static int eeprom_stats_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, eeprom_stats_show, NULL);
+}
+
+static ssize_t eeprom_stats_write(struct file *file, const char __user *buf,
+				  size_t count, loff_t *ppos)
+{
+	int cpu;
+
+	for_each_possible_cpu(cpu)
+		memset(&per_cpu(eeprom_stats, cpu), 0,
+		       sizeof(struct eeprom_stats));
+	eeprom_hw_polls = 0;
+	return count;
+}
+
+static const struct file_operations eeprom_stats_fops = {
+	.owner = THIS_MODULE,
+	.open = eeprom_stats_open,
+	.read = seq_read,
+	.write = eeprom_stats_write,
+	.llseek = seq_lseek,
+	.release = single_release
+};
+
+/*
+ * <debugfs>/eeprom/latency shows the histograms, one column of wall
+ * and one of polling time per class; writing to it clears them
+ */
+static const char *const eeprom_lat_names[EEPROM_LAT_NUM] = {
+	"read", "write", "page_read", "page_load", "program"
+};
+
+static int eeprom_latency_show(struct seq_file *m, void *v)
+{
+	struct eeprom_hist sum[EEPROM_LAT_NUM], *h;
+	int cpu, c, i;
+
+	memset(sum, 0, sizeof(sum));
+	for_each_possible_cpu(cpu) {
+		h = per_cpu(eeprom_hist, cpu);
+		for (c = 0; c < EEPROM_LAT_NUM; c++)
+			for (i = 0; i < EEPROM_HIST_BUCKETS; i++) {
+				sum[c].wall[i] += h[c].wall[i];
+				sum[c].spin[i] += h[c].spin[i];
+			}
+	}
+
+	seq_printf(m, "%-10s", "ns>=");
+	for (c = 0; c < EEPROM_LAT_NUM; c++)
+		seq_printf(m, " %10s %10s", eeprom_lat_names[c], "spin");
+	seq_putc(m, '\n');
+	for (i = 0; i < EEPROM_HIST_BUCKETS; i++) {
+		seq_printf(m, "%-10lu", i ? 1024UL << (i - 1) : 0);
+		for (c = 0; c < EEPROM_LAT_NUM; c++)
+			seq_printf(m, " %10lu %10lu",
+				   sum[c].wall[i], sum[c].spin[i]);
+		seq_putc(m, '\n');
+	}
+	return 0;
+}
+
+static int eeprom_latency_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, eeprom_latency_show, NULL);
+}
+
+static ssize_t eeprom_latency_write(struct file *file,
+				    const char __user *buf,
+				    size_t count, loff_t *ppos)
+{
+	int cpu;
+
+	for_each_possible_cpu(cpu)
+		memset(per_cpu(eeprom_hist, cpu), 0,
+		       sizeof(struct eeprom_hist) * EEPROM_LAT_NUM);
+	return count;
+}
+
+static const struct file_operations eeprom_latency_fops = {
+	.owner = THIS_MODULE,
+	.open = eeprom_latency_open,
+	.read = seq_read,
+	.write = eeprom_latency_write,
+	.llseek = seq_lseek,
+	.release = single_release
+};
+
+/*
+ * Flight recorder output, oldest entry first
+ */
+static const char *const eeprom_rec_names[] = {
+	"read", "write", "ioctl", "page_read", "program", "verify"
+};
+
+static int eeprom_rec_format(char *buf, size_t size, unsigned int pos)
+{
+	struct eeprom_rec *r = &eeprom_rec_ring[pos & (EEPROM_REC_ENTRIES - 1)];
+	u64 start = r->start;
+	unsigned long rem = do_div(start, NSEC_PER_SEC);
+
+	return scnprintf(buf, size, "[%5lu.%06lu] %-9s offset=%#x len=%u "
+			 "page=%u ns=%u result=%d",
+			 (unsigned long) start, rem / NSEC_PER_USEC,
+			 r->type < ARRAY_SIZE(eeprom_rec_names) ?
+			 eeprom_rec_names[r->type] : "?",
+			 r->offset, r->len, r->page, r->ns, r->result);
+}
+
+static inline unsigned int eeprom_rec_first(unsigned int head)
+{
+	return head > EEPROM_REC_ENTRIES ? head - EEPROM_REC_ENTRIES : 0;
+}
+
+static int eeprom_rec_show(struct seq_file *m, void *v)
+{
+	unsigned int head = atomic_read(&eeprom_rec_head), pos;
+	char line[128];
+
+	for (pos = eeprom_rec_first(head); pos != head; pos++) {
+		eeprom_rec_format(line, sizeof(line), pos);
+		seq_printf(m, "%s\n", line);
+	}
+	return 0;
+}
+
+static int eeprom_rec_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, eeprom_rec_show, NULL);
+}
+
+static const struct file_operations eeprom_rec_fops = {
+	.owner = THIS_MODULE,
+	.open = eeprom_rec_open,
+	.read = seq_read,
+	.llseek = seq_lseek,
+	.release = single_release
+};
+
+/*
+ * Dump the recorder to the kernel log the first time the kernel
+ * panics or oopses
+ */
+static atomic_t eeprom_rec_dumped = ATOMIC_INIT(0);
+
+static int eeprom_rec_dump(struct notifier_block *nb, unsigned long event,
+			   void *data)
+{
+	unsigned int head = atomic_read(&eeprom_rec_head), pos;
+	char line[128];
+
+	if (atomic_xchg(&eeprom_rec_dumped, 1))
+		return NOTIFY_DONE;
+
+	printk(KERN_EMERG "%s: last %u operations:\n", eeprom_name,
+	       head - eeprom_rec_first(head));
+	for (pos = eeprom_rec_first(head); pos != head; pos++) {
+		eeprom_rec_format(line, sizeof(line), pos);
+		printk(KERN_EMERG "%s\n", line);
+	}
+	return NOTIFY_DONE;
+}
+
+static struct notifier_block eeprom_panic_nb = {
+	.notifier_call = eeprom_rec_dump
+};
+
+static struct notifier_block eeprom_die_nb = {
+	.notifier_call = eeprom_rec_dump
+};
+
+/*
+ * <debugfs>/eeprom/debug returns the debug messages not read yet
+ */
+static DEFINE_MUTEX(eeprom_dbg_mutex);
+static unsigned int eeprom_dbg_tail;
+
+static ssize_t eeprom_dbg_read(struct file *file, char __user *buf,
+			       size_t count, loff_t *ppos)
+{
+	struct eeprom_dbg_entry *e;
+	char line[EEPROM_DBG_MSG + 32];
+	unsigned int head, lost = 0;
+	unsigned long rem;
+	ssize_t ret = 0;
+	u64 ns;
+	int n;
+
+	mutex_lock(&eeprom_dbg_mutex);
+	head = atomic_read(&eeprom_dbg_head);
+	if (head - eeprom_dbg_tail > EEPROM_DBG_ENTRIES) {
+		lost = head - eeprom_dbg_tail - EEPROM_DBG_ENTRIES;
+		eeprom_dbg_tail = head - EEPROM_DBG_ENTRIES;
+	}
+
+	while (eeprom_dbg_tail != head) {
+		e = &eeprom_dbg_ring[eeprom_dbg_tail & (EEPROM_DBG_ENTRIES - 1)];
+		if (lost) {
+			n = scnprintf(line, sizeof(line),
+				      "<%u messages lost>\n", lost);
+		} else {
+			if (e->seq != eeprom_dbg_tail)
+				break;	/* still being written */
+			smp_rmb();
+			ns = e->ns;
+			rem = do_div(ns, NSEC_PER_SEC);
+			n = scnprintf(line, sizeof(line), "[%5lu.%06lu] %s",
+				      (unsigned long) ns, rem / NSEC_PER_USEC,
+				      e->msg);
+			smp_rmb();
+			if (e->seq != eeprom_dbg_tail) {
+				lost = 1;	/* overwritten meanwhile */
+				eeprom_dbg_tail++;
+				continue;
+			}
+		}
+
+		if (n > count - ret)
+			break;
+		if (copy_to_user(buf + ret, line, n)) {
+			ret = -EFAULT;
+			break;
+		}
+		ret += n;
+		if (lost)
+			lost = 0;
+		else
+			eeprom_dbg_tail++;
+	}
+	mutex_unlock(&eeprom_dbg_mutex);
+	return ret;
+}
+
+static const struct file_operations eeprom_dbg_fops = {
+	.owner = THIS_MODULE,
+	.read = eeprom_dbg_read
+};
+
+/*
+ * <debugfs>/eeprom/wear, on the ram and file backends, shows how many
+ * times every page has been programmed and how many programs have
+ * gone to worn out pages
+ */
+static int eeprom_wear_show(struct seq_file *m, void *v)
+{
+	int page;
+
+	for (page = 0; page < EEPROM_PAGE_NUM; page++)
+		seq_printf(m, "%-16d %u\n", page, eeprom_sim_wear[page]);
+	seq_printf(m, "%-16s %u\n", "worn_programs",
+		   eeprom_sim_stats.worn_programs);
+	return 0;
+}
+
+static int eeprom_wear_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, eeprom_wear_show, NULL);
+}
+
+static const struct file_operations eeprom_wear_fops = {
+	.owner = THIS_MODULE,
+	.open = eeprom_wear_open,
+	.read = seq_read,
+	.llseek = seq_lseek,
+	.release = single_release
+};
+
+static void __init eeprom_debugfs_init(void)
+{
+	eeprom_debugfs = debugfs_create_dir(eeprom_name, NULL);
+	debugfs_create_file("stats", S_IRUSR | S_IWUSR, eeprom_debugfs,
+			    NULL, &eeprom_stats_fops);
+	debugfs_create_file("latency", S_IRUSR | S_IWUSR, eeprom_debugfs,
+			    NULL, &eeprom_latency_fops);
+	debugfs_create_file("debug", S_IRUSR, eeprom_debugfs,
+			    NULL, &eeprom_dbg_fops);
+	debugfs_create_file("recorder", S_IRUSR, eeprom_debugfs,
+			    NULL, &eeprom_rec_fops);
+	if (eeprom_hw_emulated)
+		debugfs_create_file("wear", S_IRUSR, eeprom_debugfs,
+				    NULL, &eeprom_wear_fops);
+}
+
+static struct file_operations eeprom_fops = {
+	.read = eeprom_read,
+	.write = eeprom_write,
+	.unlocked_ioctl = eeprom_ioctl,
+	.llseek = eeprom_llseek,
+	.open = eeprom_open,
+	.release = eeprom_release
+};
+
+static int __init eeprom_init_module(void)
+{
+	u32 pclk;
+	int ret = 0;
+
+	eeprom_debug_update();
+
+	/*
+ 	 * check that the user has supplied a correct major number
+ 	 */
+	if (eeprom_major == 0) {
+		printk(KERN_ALERT "%s: eeprom_major can't be 0\n", __func__);
+		ret = -EINVAL;
+		goto Done;
+	}
+
+	ret = eeprom_backend_init(&pclk);
+	if (ret < 0)
+		goto Done;
+
+	EEPROM_Init(pclk);
+	eeprom_pclk = pclk;
+	trace_eeprom_cmd_init(pclk, EEPROM_GetClkDiv(), EEPROM_GetWaitState());
+	eeprom_crc_init();
+
+	ret = eeprom_remap_init();
+	if (ret < 0)
+		goto Backend;
+	ret = eeprom_ecc_init();
+	if (ret < 0)
+		goto Backend;
+
+	ret = eeprom_regions_init();
+	if (ret < 0)
+		goto Regions;
+
+	if (eeprom_scrub_ms)
+		schedule_delayed_work(&eeprom_scrub_work,
+				      msecs_to_jiffies(eeprom_scrub_ms));
+
+	eeprom_pm_enabled = true;
+	eeprom_debugfs_init();
+	atomic_notifier_chain_register(&panic_notifier_list, &eeprom_panic_nb);
+	register_die_notifier(&eeprom_die_nb);
+#ifdef CONFIG_CPU_FREQ
+	cpufreq_register_notifier(&eeprom_cpufreq_nb,
+				  CPUFREQ_TRANSITION_NOTIFIER);
+#endif
+
+	/*
+ 	 * Register device last, once everything it uses is set up
+ 	 */
+	ret = register_chrdev(eeprom_major, eeprom_name, &eeprom_fops);
+	if (ret < 0) {
+		printk(KERN_ALERT "%s: registering device %s with major %d "
+				  "failed with %d\n",
+		       __func__, eeprom_name, eeprom_major, ret);
+		goto Notifiers;
+	}
+	goto Done;
+
+Notifiers:
+#ifdef CONFIG_CPU_FREQ
+	cpufreq_unregister_notifier(&eeprom_cpufreq_nb,
+				    CPUFREQ_TRANSITION_NOTIFIER);
+#endif
+	unregister_die_notifier(&eeprom_die_nb);
+	atomic_notifier_chain_unregister(&panic_notifier_list, &eeprom_panic_nb);
+	debugfs_remove_recursive(eeprom_debugfs);
+	eeprom_pm_enabled = false;
+	cancel_delayed_work_sync(&eeprom_scrub_work);
+Regions:
+	eeprom_regions_cleanup();
+	cancel_delayed_work_sync(&eeprom_pm_work);
+Backend:
+	eeprom_backend_cleanup();
+Done:
+	d_printk(1, "name=%s,major=%d,backend=%s\n",
+		 eeprom_name, eeprom_major, eeprom_backend);
+
+	return ret;
+}
+static void __exit eeprom_cleanup_module(void)
+{
+	/*
+	 * Unregister device
+	 */
+	unregister_chrdev(eeprom_major, eeprom_name);
+#ifdef CONFIG_CPU_FREQ
+	cpufreq_unregister_notifier(&eeprom_cpufreq_nb,
+				    CPUFREQ_TRANSITION_NOTIFIER);
+#endif
+	debugfs_remove_recursive(eeprom_debugfs);
+	unregister_die_notifier(&eeprom_die_nb);
+	atomic_notifier_chain_unregister(&panic_notifier_list, &eeprom_panic_nb);
+
+	cancel_delayed_work_sync(&eeprom_scrub_work);
+
+	/*
+	 * Write back whatever the regions still buffer
+	 */
+	eeprom_pm_enabled = false;
+	eeprom_regions_cleanup();
+	cancel_delayed_work_sync(&eeprom_pm_work);
+	eeprom_backend_cleanup();
+
+	d_printk(1, "%s\n", "clean-up successful");
+}
+
+module_init(eeprom_init_module);
+module_exit(eeprom_cleanup_module);
+
+MODULE_LICENSE("GPL");
+MODULE_AUTHOR("Andreas Haas, ah114088@gmx.de");
+MODULE_DESCRIPTION("EEPROM device driver");
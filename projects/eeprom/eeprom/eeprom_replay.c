@@ -0,0 +1,605 @@
+/*
+ * Replay of a workload captured by eeprom_shim.c.
+ *
+ * Against the simulated controller the capture is replayed once per
+ * write policy: "wt" programs the pages a write changes before it
+ * returns, as the driver's read/write path does, and "wb:<ms>" keeps
+ * changed pages in RAM and programs them once they have been dirty
+ * for <ms>, on EEPROM_IOC_SYNC and on close. Against a device (-d) the
+ * capture is replayed through the driver as it is configured, and the
+ * programs are taken from <debugfs>/eeprom/stats when it is readable.
+ *
+ * The capture does not hold the data written; every write stores
+ * a pattern that differs from the one before. ioctls that work on a
+ * range (copy, fill, compare-and-swap, CRC, compare) are replayed as a
+ * write or a read of the range. Region ioctls depend on driver state
+ * the capture does not hold and are not replayed; those that may
+ * program pages are counted in ioctls_dropped, and the program counts
+ * leave them out. Results go to stdout as JSON.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/ioctl.h>
+
+#include "eeprom.h"
+#include "eeprom_hw.h"
+#include "eeprom_capture.h"
+
+#define REPLAY_PCLK		60000000
+#define REPLAY_FDS		256
+#define REPLAY_STATS		"/sys/kernel/debug/eeprom/stats"
+#define REPLAY_POLICIES		"wt,wb:10,wb:100,wb:1000"
+
+static struct eeprom_capture_rec *replay_recs;
+static size_t replay_nrecs;
+static double replay_speed;
+
+/*
+ * Latencies of one kind of operation
+ */
+struct replay_lat {
+	u64 *ns;
+	size_t n;
+	u64 bytes;
+};
+
+struct replay_result {
+	struct replay_lat read;
+	struct replay_lat write;
+	u64 programs;
+	u64 programs_skipped;
+	u64 cache_misses;
+	u64 flush_ns;
+	u64 elapsed_ns;
+	size_t errors;
+	size_t ioctls_dropped;
+};
+
+static void usage(void)
+{
+	printf("usage:\n");
+	printf("    eeprom_replay [-s speed] [-p policies] capture\n");
+	printf("    eeprom_replay [-s speed] -d device capture\n");
+	_exit(1);
+}
+
+static u64 replay_clock_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (u64) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static int replay_load(const char *path)
+{
+	struct eeprom_capture_hdr hdr;
+	size_t size = 0;
+	FILE *f;
+	int ret = -1;
+
+	f = fopen(path, "rb");
+	if (!f) {
+		fprintf(stderr, "%s: %s\n", path, strerror(errno));
+		goto Done;
+	}
+	if (fread(&hdr, sizeof(hdr), 1, f) != 1 ||
+	    hdr.magic != EEPROM_CAPTURE_MAGIC ||
+	    hdr.version != EEPROM_CAPTURE_VERSION) {
+		fprintf(stderr, "%s: not a capture\n", path);
+		goto Done;
+	}
+
+	while (1) {
+		if (replay_nrecs == size) {
+			size = size ? 2 * size : 1024;
+			replay_recs = realloc(replay_recs,
+					      size * sizeof(*replay_recs));
+			if (!replay_recs) {
+				fprintf(stderr, "out of memory\n");
+				goto Done;
+			}
+		}
+		if (fread(&replay_recs[replay_nrecs],
+			  sizeof(*replay_recs), 1, f) != 1)
+			break;
+		replay_nrecs++;
+	}
+	ret = 0;
+
+Done:
+	if (f)
+		fclose(f);
+	return ret;
+}
+
+static void replay_pattern(u8 *buf, size_t len, size_t i)
+{
+	size_t j;
+
+	for (j = 0; j < len; j++)
+		buf[j] = i * 31 + j;
+}
+
+static void replay_add(struct replay_lat *lat, u64 ns, u64 bytes)
+{
+	lat->ns[lat->n++] = ns;
+	lat->bytes += bytes;
+}
+
+static int replay_cmp(const void *a, const void *b)
+{
+	u64 x = *(const u64 *) a, y = *(const u64 *) b;
+
+	return x < y ? -1 : x > y;
+}
+
+static u64 replay_pct(const struct replay_lat *lat, int pct)
+{
+	return lat->n ? lat->ns[(lat->n - 1) * pct / 100] : 0;
+}
+
+static void replay_print_lat(const char *name, struct replay_lat *lat)
+{
+	u64 sum = 0;
+	size_t i;
+
+	qsort(lat->ns, lat->n, sizeof(u64), replay_cmp);
+	for (i = 0; i < lat->n; i++)
+		sum += lat->ns[i];
+	printf("      \"%s\": { \"ops\": %zu, \"bytes\": %llu, "
+	       "\"mean_ns\": %llu, \"p50_ns\": %llu, \"p99_ns\": %llu, "
+	       "\"max_ns\": %llu },\n", name, lat->n,
+	       (unsigned long long) lat->bytes,
+	       (unsigned long long) (lat->n ? sum / lat->n : 0),
+	       (unsigned long long) replay_pct(lat, 50),
+	       (unsigned long long) replay_pct(lat, 99),
+	       (unsigned long long) replay_pct(lat, 100));
+}
+
+static void replay_print(const char *policy, struct replay_result *r,
+			 int first)
+{
+	u64 bytes = r->read.bytes + r->write.bytes;
+
+	printf("%s    {\n      \"policy\": \"%s\",\n", first ? "" : ",\n",
+	       policy);
+	replay_print_lat("read", &r->read);
+	replay_print_lat("write", &r->write);
+	printf("      \"programs\": %llu,\n      \"programs_skipped\": %llu,\n"
+	       "      \"cache_misses\": %llu,\n      \"flush_ns\": %llu,\n"
+	       "      \"elapsed_ns\": %llu,\n      \"throughput_Bps\": %llu,\n"
+	       "      \"errors\": %zu,\n      \"ioctls_dropped\": %zu\n"
+	       "    }",
+	       (unsigned long long) r->programs,
+	       (unsigned long long) r->programs_skipped,
+	       (unsigned long long) r->cache_misses,
+	       (unsigned long long) r->flush_ns,
+	       (unsigned long long) r->elapsed_ns,
+	       (unsigned long long) (r->elapsed_ns ?
+				     bytes * 1000000000ULL / r->elapsed_ns : 0),
+	       r->errors, r->ioctls_dropped);
+}
+
+/*
+ * A run that could not be completed, so that the output stays JSON
+ */
+static void replay_print_error(const char *policy, const char *error,
+			       int first)
+{
+	printf("%s    {\n      \"policy\": \"%s\",\n"
+	       "      \"error\": \"%s\"\n    }", first ? "" : ",\n",
+	       policy, error);
+}
+
+/*
+ * Whether an ioctl that is not replayed may have programmed pages
+ */
+static int replay_dropped(const struct eeprom_capture_rec *rec)
+{
+	switch (rec->ioctl) {
+	case _IOC_NR(EEPROM_IOC_CTR_ADD):
+	case _IOC_NR(EEPROM_IOC_CTR_SET):
+	case _IOC_NR(EEPROM_IOC_LOG_APPEND):
+	case _IOC_NR(EEPROM_IOC_KV_PUT):
+	case _IOC_NR(EEPROM_IOC_KV_DEL):
+	case _IOC_NR(EEPROM_IOC_TS_APPEND):
+	case _IOC_NR(EEPROM_IOC_FLAGS_SET):
+	case _IOC_NR(EEPROM_IOC_FLAGS_CLEAR):
+		return 1;
+	}
+	return 0;
+}
+
+static int replay_alloc(struct replay_result *r)
+{
+	memset(r, 0, sizeof(*r));
+	r->read.ns = calloc(replay_nrecs + 1, sizeof(u64));
+	r->write.ns = calloc(replay_nrecs + 1, sizeof(u64));
+	return r->read.ns && r->write.ns ? 0 : -1;
+}
+
+static void replay_free(struct replay_result *r)
+{
+	free(r->read.ns);
+	free(r->write.ns);
+}
+
+/*
+ * The driver's page cache over the simulated controller
+ */
+static u8 replay_cache[EEPROM_SIZE];
+static u8 replay_valid[EEPROM_PAGE_NUM];
+static u8 replay_dirty[EEPROM_PAGE_NUM];
+static u64 replay_dirty_since[EEPROM_PAGE_NUM];
+
+static void replay_fill(struct replay_result *r, u32 page)
+{
+	if (replay_valid[page])
+		return;
+	EEPROM_Read(0, page, (u32 *) &replay_cache[page * EEPROM_PAGE_SIZE],
+		    EEPROM_PAGE_WORDS);
+	replay_valid[page] = 1;
+	r->cache_misses++;
+}
+
+static void replay_program(struct replay_result *r, u32 page)
+{
+	EEPROM_WritePageRegister(0,
+		(u32 *) &replay_cache[page * EEPROM_PAGE_SIZE],
+		EEPROM_PAGE_WORDS);
+	EEPROM_EraseProgramPage(page);
+	replay_dirty[page] = 0;
+	r->programs++;
+}
+
+/*
+ * Program the pages dirty for window_ns by now, or all of them
+ */
+static void replay_flush(struct replay_result *r, u64 now, u64 window_ns,
+			 int all)
+{
+	u64 start = eeprom_sim_now();
+	u32 page;
+
+	for (page = 0; page < EEPROM_PAGE_NUM; page++)
+		if (replay_dirty[page] &&
+		    (all || now - replay_dirty_since[page] >= window_ns))
+			replay_program(r, page);
+	r->flush_ns += eeprom_sim_now() - start;
+}
+
+static void replay_sim_read(struct replay_result *r, u32 off, u32 end)
+{
+	u64 start = eeprom_sim_now();
+	u32 page;
+
+	for (page = off / EEPROM_PAGE_SIZE; off < end &&
+	     page * EEPROM_PAGE_SIZE < end; page++)
+		replay_fill(r, page);
+	replay_add(&r->read, eeprom_sim_now() - start,
+		   end > off ? end - off : 0);
+}
+
+/*
+ * Write pattern i over off..end, the way write() does under the policy
+ */
+static void replay_sim_write(struct replay_result *r, u32 off, u32 end,
+			     size_t i, u64 now, u64 window_ns)
+{
+	u8 buf[EEPROM_SIZE];
+	u64 start = eeprom_sim_now();
+	u32 page, n;
+
+	if (end <= off)
+		return;
+	replay_pattern(buf, end - off, i);
+	for (n = off; n < end; ) {
+		u32 stop = (n / EEPROM_PAGE_SIZE + 1) * EEPROM_PAGE_SIZE;
+
+		if (stop > end)
+			stop = end;
+		page = n / EEPROM_PAGE_SIZE;
+		replay_fill(r, page);
+		if (!memcmp(&replay_cache[n], &buf[n - off], stop - n)) {
+			r->programs_skipped++;
+		} else {
+			memcpy(&replay_cache[n], &buf[n - off], stop - n);
+			if (!window_ns)
+				replay_program(r, page);
+			else if (!replay_dirty[page]) {
+				replay_dirty[page] = 1;
+				replay_dirty_since[page] = now;
+			}
+		}
+		n = stop;
+	}
+	replay_add(&r->write, eeprom_sim_now() - start, end - off);
+}
+
+/*
+ * Replay against the simulator. window_ns is the write-back window,
+ * or 0 for write-through. Time is the later of the capture's, scaled
+ * by the speed, and the simulator's.
+ */
+static void replay_sim(struct replay_result *r, u64 window_ns)
+{
+	u64 t = 0, now;
+	u32 page, off, end;
+	size_t i;
+
+	memset(eeprom_sim_flash, 0, sizeof(eeprom_sim_flash));
+	eeprom_sim_reset(REPLAY_PCLK);
+	EEPROM_Init(REPLAY_PCLK);
+	memset(replay_valid, 0, sizeof(replay_valid));
+	memset(replay_dirty, 0, sizeof(replay_dirty));
+
+	for (i = 0; i < replay_nrecs; i++) {
+		const struct eeprom_capture_rec *rec = &replay_recs[i];
+
+		t += (u64) rec->delta_us * 1000;
+		now = eeprom_sim_now();
+		if (replay_speed > 0 && t / replay_speed > now)
+			now = t / replay_speed;
+		if (window_ns)
+			replay_flush(r, now, window_ns, 0);
+
+		if (rec->result) {
+			r->errors++;
+			continue;
+		}
+		off = rec->offset;
+		end = off + rec->len;
+		if (end > EEPROM_SIZE)
+			end = EEPROM_SIZE;
+
+		switch (rec->op) {
+		case EEPROM_CAPTURE_READ:
+			replay_sim_read(r, off, end);
+			break;
+		case EEPROM_CAPTURE_WRITE:
+			replay_sim_write(r, off, end, i, now, window_ns);
+			break;
+		case EEPROM_CAPTURE_IOCTL:
+			if (rec->ioctl == _IOC_NR(EEPROM_IOC_SYNC)) {
+				if (window_ns)
+					replay_flush(r, now, window_ns, 1);
+			} else if (rec->flags & EEPROM_CAPTURE_WROTE) {
+				/* a copy reads its source first */
+				if (rec->ioctl == _IOC_NR(EEPROM_IOC_COPY))
+					for (page = rec->src / EEPROM_PAGE_SIZE;
+					     page * EEPROM_PAGE_SIZE <
+					     (u32) rec->src + rec->len &&
+					     page < EEPROM_PAGE_NUM; page++)
+						replay_fill(r, page);
+				replay_sim_write(r, off, end, i, now,
+						 window_ns);
+			} else if (rec->len) {
+				replay_sim_read(r, off, end);
+			} else if (replay_dropped(rec)) {
+				r->ioctls_dropped++;
+			}
+			break;
+		case EEPROM_CAPTURE_CLOSE:
+			if (window_ns)
+				replay_flush(r, now, window_ns, 1);
+			break;
+		}
+	}
+	replay_flush(r, eeprom_sim_now(), window_ns, 1);
+
+	now = eeprom_sim_now();
+	if (replay_speed > 0 && t / replay_speed > now)
+		now = t / replay_speed;
+	r->elapsed_ns = now;
+}
+
+static long long replay_stat(const char *name)
+{
+	char line[80], key[40];
+	long long val = -1, v;
+	FILE *f = fopen(REPLAY_STATS, "r");
+
+	if (!f)
+		return -1;
+	while (fgets(line, sizeof(line), f))
+		if (sscanf(line, "%39s %lld", key, &v) == 2 &&
+		    !strcmp(key, name))
+			val = v;
+	fclose(f);
+	return val;
+}
+
+/*
+ * Replay against a device, through one descriptor per captured one
+ */
+static int replay_dev(struct replay_result *r, const char *dev)
+{
+	static int fds[REPLAY_FDS];
+	u8 buf[EEPROM_SIZE];
+	long long progs, skipped;
+	u64 t = 0, base, start;
+	ssize_t ret;
+	size_t i;
+	int fd;
+
+	for (fd = 0; fd < REPLAY_FDS; fd++)
+		fds[fd] = -1;
+	progs = replay_stat("programs");
+	skipped = replay_stat("programs_skipped");
+	base = replay_clock_ns();
+
+	for (i = 0; i < replay_nrecs; i++) {
+		const struct eeprom_capture_rec *rec = &replay_recs[i];
+		u32 len = rec->len;
+
+		t += (u64) rec->delta_us * 1000;
+		if (replay_speed > 0) {
+			u64 due = base + t / replay_speed, now = replay_clock_ns();
+
+			if (due > now)
+				usleep((due - now) / 1000);
+		}
+		if (rec->result) {
+			r->errors++;
+			continue;
+		}
+
+		if (rec->op == EEPROM_CAPTURE_OPEN) {
+			if (fds[rec->fd] < 0)
+				fds[rec->fd] = open(dev, O_RDWR);
+			if (fds[rec->fd] < 0) {
+				fprintf(stderr, "%s: %s\n", dev, strerror(errno));
+				ret = -1;
+				goto Done;
+			}
+			continue;
+		}
+		fd = fds[rec->fd];
+		if (fd < 0)
+			continue;
+		if (len > sizeof(buf))
+			len = sizeof(buf);
+
+		start = replay_clock_ns();
+		switch (rec->op) {
+		case EEPROM_CAPTURE_CLOSE:
+			close(fd);
+			fds[rec->fd] = -1;
+			break;
+		case EEPROM_CAPTURE_READ:
+			ret = pread(fd, buf, len, rec->offset);
+			if (ret < 0)
+				r->errors++;
+			else
+				replay_add(&r->read, replay_clock_ns() - start,
+					   ret);
+			break;
+		case EEPROM_CAPTURE_WRITE:
+			replay_pattern(buf, len, i);
+			ret = pwrite(fd, buf, len, rec->offset);
+			if (ret < 0)
+				r->errors++;
+			else
+				replay_add(&r->write, replay_clock_ns() - start,
+					   ret);
+			break;
+		case EEPROM_CAPTURE_IOCTL:
+			if (rec->ioctl == _IOC_NR(EEPROM_IOC_SYNC)) {
+				if (ioctl(fd, EEPROM_IOC_SYNC) < 0)
+					r->errors++;
+			} else if (rec->flags & EEPROM_CAPTURE_WROTE) {
+				replay_pattern(buf, len, i);
+				ret = pwrite(fd, buf, len, rec->offset);
+				if (ret < 0)
+					r->errors++;
+				else
+					replay_add(&r->write,
+						   replay_clock_ns() - start, ret);
+			} else if (len) {
+				ret = pread(fd, buf, len, rec->offset);
+				if (ret < 0)
+					r->errors++;
+				else
+					replay_add(&r->read,
+						   replay_clock_ns() - start, ret);
+			} else if (replay_dropped(rec)) {
+				r->ioctls_dropped++;
+			}
+			break;
+		}
+	}
+	ret = 0;
+
+Done:
+	for (fd = 0; fd < REPLAY_FDS; fd++)
+		if (fds[fd] >= 0)
+			close(fds[fd]);
+	r->elapsed_ns = replay_clock_ns() - base;
+
+	if (progs >= 0)
+		r->programs = replay_stat("programs") - progs;
+	if (skipped >= 0)
+		r->programs_skipped = replay_stat("programs_skipped") - skipped;
+	return ret;
+}
+
+int main(int argc, char **argv)
+{
+	struct replay_result r;
+	const char *dev = NULL;
+	char *policies = REPLAY_POLICIES, *p, *next;
+	int opt, ret = 1;
+
+	while ((opt = getopt(argc, argv, "s:p:d:")) != -1) {
+		switch (opt) {
+		case 's':
+			replay_speed = atof(optarg);
+			break;
+		case 'p':
+			policies = optarg;
+			break;
+		case 'd':
+			dev = optarg;
+			break;
+		default:
+			usage();
+		}
+	}
+	if (optind != argc - 1 || replay_speed < 0)
+		usage();
+	if (replay_load(argv[optind]) < 0)
+		return 1;
+
+	printf("{\n  \"capture\": \"%s\",\n  \"records\": %zu,\n"
+	       "  \"speed\": %g,\n  \"runs\": [\n",
+	       argv[optind], replay_nrecs, replay_speed);
+
+	if (dev) {
+		if (replay_alloc(&r) < 0) {
+			replay_print_error(dev, "out of memory", 1);
+			goto Done;
+		}
+		if (replay_dev(&r, dev) < 0) {
+			replay_print_error(dev, "open failed", 1);
+			replay_free(&r);
+			goto Done;
+		}
+		replay_print(dev, &r, 1);
+		replay_free(&r);
+	} else {
+		policies = strdup(policies);
+		for (p = policies; p; p = next) {
+			next = strchr(p, ',');
+			if (next)
+				*next++ = 0;
+			if (strcmp(p, "wt") && strncmp(p, "wb:", 3)) {
+				fprintf(stderr, "unknown policy %s\n", p);
+				replay_print_error(p, "unknown policy",
+						   p == policies);
+				goto Done;
+			}
+			if (replay_alloc(&r) < 0) {
+				replay_print_error(p, "out of memory",
+						   p == policies);
+				goto Done;
+			}
+			replay_sim(&r, p[1] == 'b' ?
+				   strtoull(p + 3, NULL, 0) * 1000000ULL : 0);
+			replay_print(p, &r, p == policies);
+			replay_free(&r);
+		}
+	}
+	ret = 0;
+
+Done:
+	/* close the runs even after an error, so the output stays JSON */
+	printf("\n  ]\n}\n");
+	return ret;
+}
@@ -0,0 +1,416 @@
+/*
+ * Preload shim that captures how a program uses /dev/eeprom:
+ *
+ *     EEPROM_CAPTURE=app.cap LD_PRELOAD=./libeeprom_shim.so app ...
+ *
+ * Every open, close, read, write and ioctl on the device is recorded,
+ * see eeprom_capture.h; everything else passes straight through.
+ * EEPROM_DEV names a device other than /dev/eeprom to capture.
+ *
+ * The process the capture starts in writes to EEPROM_CAPTURE; the
+ * processes it forks or executes write to EEPROM_CAPTURE.<pid>, so
+ * that each capture file holds one process. The starting process is
+ * passed down in EEPROM_CAPTURE_PID. A capture file is only created
+ * once its process uses the device.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dlfcn.h>
+#include <pthread.h>
+#include <time.h>
+#include <sys/ioctl.h>
+
+#include "eeprom.h"
+#include "eeprom_capture.h"
+
+#define SHIM_FDS		256
+
+static pthread_mutex_t shim_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_once_t shim_once = PTHREAD_ONCE_INIT;
+static const char *shim_dev = "/dev/eeprom";
+static int shim_out = -1;
+static int shim_started;
+static uint64_t shim_last_ns;
+static unsigned char shim_fds[SHIM_FDS];
+
+static int (*real_open)(const char *, int, ...);
+static int (*real_open64)(const char *, int, ...);
+static int (*real_openat)(int, const char *, int, ...);
+static int (*real_openat64)(int, const char *, int, ...);
+static int (*real_close)(int);
+static ssize_t (*real_read)(int, void *, size_t);
+static ssize_t (*real_write)(int, const void *, size_t);
+static ssize_t (*real_pread)(int, void *, size_t, off_t);
+static ssize_t (*real_pwrite)(int, const void *, size_t, off_t);
+static ssize_t (*real_pread64)(int, void *, size_t, off64_t);
+static ssize_t (*real_pwrite64)(int, const void *, size_t, off64_t);
+static int (*real_ioctl)(int, unsigned long, ...);
+
+static uint64_t shim_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/*
+ * Start the capture file of this process, with shim_mutex held
+ */
+static void shim_start(void)
+{
+	struct eeprom_capture_hdr hdr;
+	const char *path = getenv("EEPROM_CAPTURE");
+	const char *owner = getenv("EEPROM_CAPTURE_PID");
+	char buf[PATH_MAX];
+
+	shim_started = 1;
+	if (!path)
+		path = "eeprom.cap";
+	if (owner && atoi(owner) != getpid()) {
+		snprintf(buf, sizeof(buf), "%s.%d", path, (int) getpid());
+		path = buf;
+	}
+
+	shim_out = real_open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC,
+			     0644);
+	if (shim_out < 0) {
+		fprintf(stderr, "eeprom_shim: %s: %s\n", path, strerror(errno));
+		return;
+	}
+
+	hdr.magic = EEPROM_CAPTURE_MAGIC;
+	hdr.version = EEPROM_CAPTURE_VERSION;
+	hdr.start_ns = shim_last_ns = shim_now();
+	if (real_write(shim_out, &hdr, sizeof(hdr)) != sizeof(hdr)) {
+		real_close(shim_out);
+		shim_out = -1;
+	}
+}
+
+/*
+ * A forked child must not append to its parent's capture, nor find
+ * shim_mutex held by a thread that does not exist in it
+ */
+static void shim_fork_prepare(void)
+{
+	pthread_mutex_lock(&shim_mutex);
+}
+
+static void shim_fork_parent(void)
+{
+	pthread_mutex_unlock(&shim_mutex);
+}
+
+static void shim_fork_child(void)
+{
+	if (shim_out >= 0)
+		real_close(shim_out);
+	shim_out = -1;
+	shim_started = 0;
+	pthread_mutex_unlock(&shim_mutex);
+}
+
+static void shim_init(void)
+{
+	real_open = dlsym(RTLD_NEXT, "open");
+	real_open64 = dlsym(RTLD_NEXT, "open64");
+	real_openat = dlsym(RTLD_NEXT, "openat");
+	real_openat64 = dlsym(RTLD_NEXT, "openat64");
+	real_close = dlsym(RTLD_NEXT, "close");
+	real_read = dlsym(RTLD_NEXT, "read");
+	real_write = dlsym(RTLD_NEXT, "write");
+	real_pread = dlsym(RTLD_NEXT, "pread");
+	real_pwrite = dlsym(RTLD_NEXT, "pwrite");
+	real_pread64 = dlsym(RTLD_NEXT, "pread64");
+	real_pwrite64 = dlsym(RTLD_NEXT, "pwrite64");
+	real_ioctl = dlsym(RTLD_NEXT, "ioctl");
+
+	if (getenv("EEPROM_DEV"))
+		shim_dev = getenv("EEPROM_DEV");
+	if (!getenv("EEPROM_CAPTURE_PID")) {
+		char pid[16];
+
+		snprintf(pid, sizeof(pid), "%d", (int) getpid());
+		setenv("EEPROM_CAPTURE_PID", pid, 0);
+	}
+
+	pthread_atfork(shim_fork_prepare, shim_fork_parent, shim_fork_child);
+}
+
+static int shim_is_dev(int fd)
+{
+	return fd >= 0 && fd < SHIM_FDS && shim_fds[fd];
+}
+
+static void shim_emit(struct eeprom_capture_rec *rec, long result)
+{
+	uint64_t now;
+	int err = errno;
+
+	pthread_mutex_lock(&shim_mutex);
+	if (!shim_started)
+		shim_start();
+	if (shim_out < 0)
+		goto Done;
+
+	now = shim_now();
+	rec->delta_us = (now - shim_last_ns) / 1000;
+	shim_last_ns = now;
+	rec->result = result < 0 ? -err : 0;
+	if (real_write(shim_out, rec, sizeof(*rec)) != sizeof(*rec)) {
+		real_close(shim_out);
+		shim_out = -1;
+	}
+Done:
+	pthread_mutex_unlock(&shim_mutex);
+	errno = err;
+}
+
+static void shim_record(int op, int fd, off_t offset, long len, long result)
+{
+	struct eeprom_capture_rec rec;
+
+	memset(&rec, 0, sizeof(rec));
+	rec.offset = offset < 0 ? 0 : offset;
+	rec.len = len < 0 ? 0 : len > 0xffff ? 0xffff : len;
+	rec.op = op;
+	rec.fd = fd;
+	shim_emit(&rec, result);
+}
+
+/*
+ * Record an ioctl, with the range it covered if it works on one
+ */
+static void shim_record_ioctl(int fd, unsigned long request, void *arg,
+			      long result)
+{
+	struct eeprom_capture_rec rec;
+	const struct eeprom_copy *copy = arg;
+	const struct eeprom_fill *fill = arg;
+	const struct eeprom_crc *crc = arg;
+	const struct eeprom_cmp *cmp = arg;
+	const struct eeprom_cas *cas = arg;
+	uint32_t offset = 0, len = 0;
+
+	memset(&rec, 0, sizeof(rec));
+	rec.op = EEPROM_CAPTURE_IOCTL;
+	rec.fd = fd;
+	rec.ioctl = _IOC_NR(request);
+
+	if (result >= 0 && arg) {
+		switch (request) {
+		case EEPROM_IOC_COPY:
+			offset = copy->dst;
+			len = copy->len;
+			rec.src = copy->src;
+			rec.flags = EEPROM_CAPTURE_WROTE;
+			break;
+		case EEPROM_IOC_FILL:
+			offset = fill->offset;
+			len = fill->len;
+			rec.flags = EEPROM_CAPTURE_WROTE;
+			break;
+		case EEPROM_IOC_CAS:
+			offset = cas->offset;
+			len = cas->len;
+			if (cas->swapped)
+				rec.flags = EEPROM_CAPTURE_WROTE;
+			break;
+		case EEPROM_IOC_CRC:
+			offset = crc->offset;
+			len = crc->len;
+			break;
+		case EEPROM_IOC_CMP:
+			offset = cmp->offset;
+			len = cmp->len;
+			break;
+		}
+	}
+	rec.offset = offset > 0xffff ? 0xffff : offset;
+	rec.len = len > 0xffff ? 0xffff : len;
+	shim_emit(&rec, result);
+}
+
+static int shim_opened(const char *path, int fd)
+{
+	pthread_once(&shim_once, shim_init);
+	if (fd >= 0 && fd < SHIM_FDS && !strcmp(path, shim_dev)) {
+		shim_fds[fd] = 1;
+		shim_record(EEPROM_CAPTURE_OPEN, fd, 0, 0, fd);
+	}
+	return fd;
+}
+
+int open(const char *path, int flags, ...)
+{
+	mode_t mode = 0;
+	va_list args;
+
+	pthread_once(&shim_once, shim_init);
+	if (flags & O_CREAT) {
+		va_start(args, flags);
+		mode = va_arg(args, mode_t);
+		va_end(args);
+	}
+	return shim_opened(path, real_open(path, flags, mode));
+}
+
+/*
+ * The 64-bit variants add O_LARGEFILE where off_t is 32 bits, so they
+ * are passed on to their own originals
+ */
+int open64(const char *path, int flags, ...)
+{
+	mode_t mode = 0;
+	va_list args;
+
+	pthread_once(&shim_once, shim_init);
+	if (flags & O_CREAT) {
+		va_start(args, flags);
+		mode = va_arg(args, mode_t);
+		va_end(args);
+	}
+	return shim_opened(path, real_open64(path, flags, mode));
+}
+
+int openat(int dirfd, const char *path, int flags, ...)
+{
+	mode_t mode = 0;
+	va_list args;
+
+	pthread_once(&shim_once, shim_init);
+	if (flags & O_CREAT) {
+		va_start(args, flags);
+		mode = va_arg(args, mode_t);
+		va_end(args);
+	}
+	return shim_opened(path, real_openat(dirfd, path, flags, mode));
+}
+
+int openat64(int dirfd, const char *path, int flags, ...)
+{
+	mode_t mode = 0;
+	va_list args;
+
+	pthread_once(&shim_once, shim_init);
+	if (flags & O_CREAT) {
+		va_start(args, flags);
+		mode = va_arg(args, mode_t);
+		va_end(args);
+	}
+	return shim_opened(path, real_openat64(dirfd, path, flags, mode));
+}
+
+int close(int fd)
+{
+	int ret;
+
+	pthread_once(&shim_once, shim_init);
+	ret = real_close(fd);
+	if (shim_is_dev(fd)) {
+		shim_fds[fd] = 0;
+		shim_record(EEPROM_CAPTURE_CLOSE, fd, 0, 0, ret);
+	}
+	return ret;
+}
+
+ssize_t read(int fd, void *buf, size_t count)
+{
+	off_t pos;
+	ssize_t ret;
+
+	pthread_once(&shim_once, shim_init);
+	if (!shim_is_dev(fd))
+		return real_read(fd, buf, count);
+	pos = lseek(fd, 0, SEEK_CUR);
+	ret = real_read(fd, buf, count);
+	shim_record(EEPROM_CAPTURE_READ, fd, pos, ret < 0 ? (ssize_t) count : ret, ret);
+	return ret;
+}
+
+ssize_t write(int fd, const void *buf, size_t count)
+{
+	off_t pos;
+	ssize_t ret;
+
+	pthread_once(&shim_once, shim_init);
+	if (!shim_is_dev(fd))
+		return real_write(fd, buf, count);
+	pos = lseek(fd, 0, SEEK_CUR);
+	ret = real_write(fd, buf, count);
+	shim_record(EEPROM_CAPTURE_WRITE, fd, pos, ret < 0 ? (ssize_t) count : ret, ret);
+	return ret;
+}
+
+ssize_t pread(int fd, void *buf, size_t count, off_t offset)
+{
+	ssize_t ret;
+
+	pthread_once(&shim_once, shim_init);
+	ret = real_pread(fd, buf, count, offset);
+	if (shim_is_dev(fd))
+		shim_record(EEPROM_CAPTURE_READ, fd, offset,
+			    ret < 0 ? (ssize_t) count : ret, ret);
+	return ret;
+}
+
+ssize_t pwrite(int fd, const void *buf, size_t count, off_t offset)
+{
+	ssize_t ret;
+
+	pthread_once(&shim_once, shim_init);
+	ret = real_pwrite(fd, buf, count, offset);
+	if (shim_is_dev(fd))
+		shim_record(EEPROM_CAPTURE_WRITE, fd, offset,
+			    ret < 0 ? (ssize_t) count : ret, ret);
+	return ret;
+}
+
+ssize_t pread64(int fd, void *buf, size_t count, off64_t offset)
+{
+	ssize_t ret;
+
+	pthread_once(&shim_once, shim_init);
+	ret = real_pread64(fd, buf, count, offset);
+	if (shim_is_dev(fd))
+		shim_record(EEPROM_CAPTURE_READ, fd, offset,
+			    ret < 0 ? (ssize_t) count : ret, ret);
+	return ret;
+}
+
+ssize_t pwrite64(int fd, const void *buf, size_t count, off64_t offset)
+{
+	ssize_t ret;
+
+	pthread_once(&shim_once, shim_init);
+	ret = real_pwrite64(fd, buf, count, offset);
+	if (shim_is_dev(fd))
+		shim_record(EEPROM_CAPTURE_WRITE, fd, offset,
+			    ret < 0 ? (ssize_t) count : ret, ret);
+	return ret;
+}
+
+int ioctl(int fd, unsigned long request, ...)
+{
+	va_list args;
+	void *arg;
+	int ret;
+
+	pthread_once(&shim_once, shim_init);
+	va_start(args, request);
+	arg = va_arg(args, void *);
+	va_end(args);
+	ret = real_ioctl(fd, request, arg);
+	if (shim_is_dev(fd))
+		shim_record_ioctl(fd, request, arg, ret);
+	return ret;
+}
@@ -0,0 +1,287 @@
+/*
+ * eeprom_sim.c - Simulated LPC 17xx EEPROM register block.
+ */
+
+#ifdef __KERNEL__
+#include <linux/string.h>
+#include <linux/math64.h>
+
+#define eeprom_sim_div(n, d)	div_u64((n), (d))
+#else
+#include <string.h>
+
+#define eeprom_sim_div(n, d)	((n) / (d))
+#endif
+
+#include "eeprom_hw.h"
+#include "eeprom_sim.h"
+
+#define EEPROM_SIM_REG(reg)	offsetof(EEPROM_T, reg)
+
+struct eeprom_sim_stats eeprom_sim_stats;
+u8 eeprom_sim_flash[EEPROM_SIZE];
+u32 eeprom_sim_wear[EEPROM_PAGE_NUM];
+u64 eeprom_sim_prog_ns;
+u32 eeprom_sim_endurance;
+u64 (*eeprom_sim_clock)(void);
+void (*eeprom_sim_programmed)(u32 page);
+
+static struct {
+	u32 pclk;
+	u32 cmd;
+	u32 addr;
+	u32 rdata;
+	u32 wstate;
+	u32 clkdiv;
+	u32 pwrdwn;
+	u32 inten;
+	u32 intstat;
+	u8 pagereg[EEPROM_PAGE_SIZE];
+	u64 now;		/* simulated time */
+	u64 done;		/* end of the operation in progress */
+	u32 pending;		/* INTSTAT bits it sets when done */
+} sim;
+
+static u64 eeprom_sim_cycles(u64 cycles)
+{
+	return eeprom_sim_div(cycles * 1000000000ULL, sim.pclk);
+}
+
+/*
+ * Complete the operation in progress if its time has come
+ */
+static void eeprom_sim_update(void)
+{
+	if (sim.pending && sim.now >= sim.done) {
+		sim.intstat |= sim.pending;
+		sim.pending = 0;
+	}
+}
+
+/*
+ * Advance time by a register access, or to the clock followed
+ */
+static void eeprom_sim_tick(void)
+{
+	u64 t;
+
+	if (eeprom_sim_clock) {
+		t = eeprom_sim_clock();
+		if (t > sim.now)
+			sim.now = t;
+	} else
+		sim.now += eeprom_sim_cycles(EEPROM_SIM_BUS_CYCLES);
+	eeprom_sim_update();
+}
+
+/*
+ * Wait for the operation in progress, as a bus access to a busy
+ * controller does
+ */
+static void eeprom_sim_stall(void)
+{
+	if (sim.pending && sim.now < sim.done)
+		sim.now = sim.done;
+	eeprom_sim_update();
+}
+
+/*
+ * Check the timing set up in CLKDIV and WSTATE against the limits
+ */
+static void eeprom_sim_check(void)
+{
+	static const u32 phase_ns[3] = { 15, 55, 35 };
+	u32 i, cycles;
+
+	if (sim.pwrdwn)
+		eeprom_sim_stats.powered_down++;
+
+	if (sim.pclk / (sim.clkdiv + 1) > EEPROM_SIM_CLK_MAX) {
+		eeprom_sim_stats.timing_errors++;
+		return;
+	}
+	for (i = 0; i < 3; i++) {
+		cycles = ((sim.wstate >> (8 * i)) & 0xff) + 1;
+		if (eeprom_sim_cycles(cycles) < phase_ns[i]) {
+			eeprom_sim_stats.timing_errors++;
+			return;
+		}
+	}
+}
+
+/*
+ * Start an operation taking ns, which sets bits in INTSTAT when done
+ */
+static void eeprom_sim_start(u64 ns, u32 bits)
+{
+	eeprom_sim_stall();
+	eeprom_sim_check();
+	sim.done = sim.now + ns;
+	sim.pending = bits;
+	eeprom_sim_stats.busy_ns += ns;
+}
+
+static u64 eeprom_sim_word_ns(void)
+{
+	return eeprom_sim_cycles((sim.wstate & 0xff) +
+				 ((sim.wstate >> 8) & 0xff) +
+				 ((sim.wstate >> 16) & 0xff) + 3);
+}
+
+static u32 eeprom_sim_width(void)
+{
+	return 1 << ((sim.cmd & 7) % 3);
+}
+
+/*
+ * Fetch the data at ADDR for a read command
+ */
+static void eeprom_sim_fetch(void)
+{
+	u32 w = eeprom_sim_width(), a = sim.addr & ~(w - 1);
+
+	sim.rdata = 0;
+	if (a + w <= EEPROM_SIZE)
+		memcpy(&sim.rdata, &eeprom_sim_flash[a], w);
+	eeprom_sim_start(eeprom_sim_word_ns(), EEPROM_INT_ENDOFRW);
+}
+
+static void eeprom_sim_program(void)
+{
+	u32 page = (sim.addr >> 6) & 0x3f;
+	u64 ns = eeprom_sim_prog_ns;
+
+	if (!ns)
+		ns = eeprom_sim_cycles((u64) EEPROM_SIM_PROG_CLKS *
+				       (sim.clkdiv + 1));
+	eeprom_sim_start(ns, EEPROM_INT_ENDOFPROG);
+	if (page >= EEPROM_PAGE_NUM)
+		return;
+
+	if (eeprom_sim_endurance &&
+	    eeprom_sim_wear[page] >= eeprom_sim_endurance) {
+		eeprom_sim_stats.worn_programs++;
+		eeprom_sim_wear[page]++;
+		return;
+	}
+	memcpy(&eeprom_sim_flash[page * EEPROM_PAGE_SIZE],
+	       sim.pagereg, EEPROM_PAGE_SIZE);
+	eeprom_sim_wear[page]++;
+	if (eeprom_sim_programmed)
+		eeprom_sim_programmed(page);
+}
+
+void eeprom_sim_reset(u32 pclk)
+{
+	memset(&sim, 0, sizeof(sim));
+	memset(&eeprom_sim_stats, 0, sizeof(eeprom_sim_stats));
+	sim.pclk = pclk;
+}
+
+void eeprom_sim_set_pclk(u32 pclk)
+{
+	sim.pclk = pclk;
+}
+
+u32 eeprom_sim_read(u32 offset)
+{
+	u32 val = 0, w;
+
+	eeprom_sim_tick();
+	eeprom_sim_stats.reg_reads++;
+
+	switch (offset) {
+	case EEPROM_SIM_REG(CMD):
+		val = sim.cmd;
+		break;
+	case EEPROM_SIM_REG(ADDR):
+		val = sim.addr;
+		break;
+	case EEPROM_SIM_REG(RDATA):
+		eeprom_sim_stall();
+		eeprom_sim_stats.words_read++;
+		val = sim.rdata;
+		if (sim.cmd & EEPROM_CMD_RDPREFETCH) {
+			w = eeprom_sim_width();
+			sim.addr = (sim.addr + w) & 0xfff;
+			eeprom_sim_fetch();
+		}
+		break;
+	case EEPROM_SIM_REG(WSTATE):
+		val = sim.wstate;
+		break;
+	case EEPROM_SIM_REG(CLKDIV):
+		val = sim.clkdiv;
+		break;
+	case EEPROM_SIM_REG(PWRDWN):
+		val = sim.pwrdwn;
+		break;
+	case EEPROM_SIM_REG(INTSTAT):
+		eeprom_sim_stats.polls++;
+		val = sim.intstat;
+		break;
+	case EEPROM_SIM_REG(INTEN):
+		val = sim.inten;
+		break;
+	}
+	return val;
+}
+
+void eeprom_sim_write(u32 offset, u32 val)
+{
+	u32 w, off;
+
+	eeprom_sim_tick();
+	eeprom_sim_stats.reg_writes++;
+
+	switch (offset) {
+	case EEPROM_SIM_REG(CMD):
+		sim.cmd = val;
+		eeprom_sim_stats.cmds[val & 7]++;
+		if ((val & 7) <= EEPROM_CMD_32BITS_READ)
+			eeprom_sim_fetch();
+		else if ((val & 7) == EEPROM_CMD_ERASE_PRG_PAGE)
+			eeprom_sim_program();
+		break;
+	case EEPROM_SIM_REG(ADDR):
+		sim.addr = val & 0xfff;
+		break;
+	case EEPROM_SIM_REG(WDATA):
+		if ((sim.cmd & 7) < EEPROM_CMD_8BITS_WRITE ||
+		    (sim.cmd & 7) > EEPROM_CMD_32BITS_WRITE)
+			break;
+		w = eeprom_sim_width();
+		off = sim.addr & (EEPROM_PAGE_SIZE - 1) & ~(w - 1);
+		eeprom_sim_start(eeprom_sim_word_ns(), EEPROM_INT_ENDOFRW);
+		memcpy(&sim.pagereg[off], &val, w);
+		sim.addr = (sim.addr + w) & 0xfff;
+		eeprom_sim_stats.words_written++;
+		break;
+	case EEPROM_SIM_REG(WSTATE):
+		sim.wstate = val;
+		break;
+	case EEPROM_SIM_REG(CLKDIV):
+		sim.clkdiv = val & 0xffff;
+		break;
+	case EEPROM_SIM_REG(PWRDWN):
+		sim.pwrdwn = val & 1;
+		break;
+	case EEPROM_SIM_REG(INTENCLR):
+		sim.inten &= ~val;
+		break;
+	case EEPROM_SIM_REG(INTENSET):
+		sim.inten |= val;
+		break;
+	case EEPROM_SIM_REG(INTSTATCLR):
+		sim.intstat &= ~val;
+		break;
+	case EEPROM_SIM_REG(INTSTATSET):
+		sim.intstat |= val;
+		break;
+	}
+}
+
+u64 eeprom_sim_now(void)
+{
+	return sim.now;
+}
@@ -0,0 +1,88 @@
+/*
+ * eeprom_sim.h - Simulated LPC 17xx EEPROM register block.
+ *
+ * Models the EEPROM_T registers well enough to run the driver core:
+ * read and write commands with prefetch and address increment, the
+ * page register, erase/program, and INTSTAT completion bits that are
+ * set once the operation's time has passed. Time is simulated: every
+ * register access costs EEPROM_SIM_BUS_CYCLES PCLK cycles, a word read
+ * or write takes the three WSTATE phases and an erase/program takes
+ * EEPROM_SIM_PROG_CLKS cycles of the CLKDIV divided clock.
+ *
+ * The same code backs the ram and file backends of the kernel module,
+ * which have time follow a real clock so that commands take as long as
+ * they do on the device.
+ */
+
+#ifndef _EEPROM_SIM_H_
+#define _EEPROM_SIM_H_
+
+#define EEPROM_SIM_BUS_CYCLES		4
+#define EEPROM_SIM_PROG_CLKS		1125	/* 3ms at 375kHz */
+#define EEPROM_SIM_CLK_MAX		400000
+
+/*
+ * What the simulated controller has done since the last reset
+ */
+struct eeprom_sim_stats {
+	u64 reg_reads;		/* register reads */
+	u64 reg_writes;		/* register writes */
+	u64 polls;		/* reads of INTSTAT */
+	u64 cmds[8];		/* commands, by CMD code */
+	u64 words_read;		/* RDATA reads */
+	u64 words_written;	/* WDATA writes */
+	u64 busy_ns;		/* time the controller was busy */
+	u32 timing_errors;	/* commands issued with illegal timing */
+	u32 powered_down;	/* commands issued with PWRDWN set */
+	u32 worn_programs;	/* programs of worn out pages */
+};
+
+extern struct eeprom_sim_stats eeprom_sim_stats;
+
+/*
+ * The array, and how many times each page has been programmed
+ */
+extern u8 eeprom_sim_flash[EEPROM_SIZE];
+extern u32 eeprom_sim_wear[EEPROM_PAGE_NUM];
+
+/*
+ * Time an erase/program takes in ns; 0 works it out from CLKDIV
+ */
+extern u64 eeprom_sim_prog_ns;
+
+/*
+ * Programs a page takes before it wears out, 0 for no limit. Programs
+ * of a worn out page complete but leave it as it was.
+ */
+extern u32 eeprom_sim_endurance;
+
+/*
+ * Clock in ns for simulated time to keep up with, if set
+ */
+extern u64 (*eeprom_sim_clock)(void);
+
+/*
+ * Called when a program has changed a page of the array, if set
+ */
+extern void (*eeprom_sim_programmed)(u32 page);
+
+/*
+ * Reset the controller and the statistics, leaving the array alone.
+ * pclk is the PCLK rate the timing is worked out from.
+ */
+void eeprom_sim_reset(u32 pclk);
+
+/*
+ * Change the PCLK rate, leaving CLKDIV and WSTATE as they are
+ */
+void eeprom_sim_set_pclk(u32 pclk);
+
+u32 eeprom_sim_read(u32 offset);
+void eeprom_sim_write(u32 offset, u32 val);
+
+/*
+ * Simulated time in ns
+ */
+u64 eeprom_sim_now(void);
+
+#endif /* _EEPROM_SIM_H_ */
@@ -0,0 +1,158 @@
+/*
+ * eeprom_trace.h - Trace events of the LPC 17xx EEPROM driver.
+ *
+ * Controller commands report the page, the offset and number of words
+ * they moved and how long they took; loads of the page register are
+ * not tied to a page and report page 0. read() and write() report their
+ * entry and, on exit, the result and the time taken. The time is 0 when
+ * the event was enabled while the section ran.
+ */
+
+#undef TRACE_SYSTEM
+#define TRACE_SYSTEM eeprom
+
+#if !defined(_EEPROM_TRACE_H_) || defined(TRACE_HEADER_MULTI_READ)
+#define _EEPROM_TRACE_H_
+
+#include <linux/tracepoint.h>
+#include <linux/ktime.h>
+
+DECLARE_EVENT_CLASS(eeprom_cmd,
+
+	TP_PROTO(u16 page, u32 offset, u32 words, ktime_t start),
+
+	TP_ARGS(page, offset, words, start),
+
+	TP_STRUCT__entry(
+		__field(u16, page)
+		__field(u32, offset)
+		__field(u32, words)
+		__field(s64, ns)
+	),
+
+	TP_fast_assign(
+		__entry->page = page;
+		__entry->offset = offset;
+		__entry->words = words;
+		__entry->ns = ktime_to_ns(start) ?
+			ktime_to_ns(ktime_sub(ktime_get(), start)) : 0;
+	),
+
+	TP_printk("page=%u offset=%u words=%u ns=%lld",
+		  __entry->page, __entry->offset, __entry->words,
+		  (long long) __entry->ns)
+);
+
+DEFINE_EVENT(eeprom_cmd, eeprom_cmd_read,
+	TP_PROTO(u16 page, u32 offset, u32 words, ktime_t start),
+	TP_ARGS(page, offset, words, start)
+);
+
+DEFINE_EVENT(eeprom_cmd, eeprom_cmd_load,
+	TP_PROTO(u16 page, u32 offset, u32 words, ktime_t start),
+	TP_ARGS(page, offset, words, start)
+);
+
+DEFINE_EVENT(eeprom_cmd, eeprom_cmd_program,
+	TP_PROTO(u16 page, u32 offset, u32 words, ktime_t start),
+	TP_ARGS(page, offset, words, start)
+);
+
+TRACE_EVENT(eeprom_cmd_init,
+
+	TP_PROTO(u32 pclk, u32 clkdiv, u32 wstate),
+
+	TP_ARGS(pclk, clkdiv, wstate),
+
+	TP_STRUCT__entry(
+		__field(u32, pclk)
+		__field(u32, clkdiv)
+		__field(u32, wstate)
+	),
+
+	TP_fast_assign(
+		__entry->pclk = pclk;
+		__entry->clkdiv = clkdiv;
+		__entry->wstate = wstate;
+	),
+
+	TP_printk("pclk=%u clkdiv=%u wstate=0x%06x",
+		  __entry->pclk, __entry->clkdiv, __entry->wstate)
+);
+
+DECLARE_EVENT_CLASS(eeprom_rw_enter,
+
+	TP_PROTO(loff_t offset, size_t len),
+
+	TP_ARGS(offset, len),
+
+	TP_STRUCT__entry(
+		__field(loff_t, offset)
+		__field(size_t, len)
+	),
+
+	TP_fast_assign(
+		__entry->offset = offset;
+		__entry->len = len;
+	),
+
+	TP_printk("offset=%lld len=%zu",
+		  (long long) __entry->offset, __entry->len)
+);
+
+DEFINE_EVENT(eeprom_rw_enter, eeprom_read_enter,
+	TP_PROTO(loff_t offset, size_t len),
+	TP_ARGS(offset, len)
+);
+
+DEFINE_EVENT(eeprom_rw_enter, eeprom_write_enter,
+	TP_PROTO(loff_t offset, size_t len),
+	TP_ARGS(offset, len)
+);
+
+DECLARE_EVENT_CLASS(eeprom_rw_exit,
+
+	TP_PROTO(loff_t offset, size_t len, ssize_t ret, ktime_t start),
+
+	TP_ARGS(offset, len, ret, start),
+
+	TP_STRUCT__entry(
+		__field(loff_t, offset)
+		__field(size_t, len)
+		__field(ssize_t, ret)
+		__field(s64, ns)
+	),
+
+	TP_fast_assign(
+		__entry->offset = offset;
+		__entry->len = len;
+		__entry->ret = ret;
+		__entry->ns = ktime_to_ns(start) ?
+			ktime_to_ns(ktime_sub(ktime_get(), start)) : 0;
+	),
+
+	TP_printk("offset=%lld len=%zu ret=%zd ns=%lld",
+		  (long long) __entry->offset, __entry->len, __entry->ret,
+		  (long long) __entry->ns)
+);
+
+DEFINE_EVENT(eeprom_rw_exit, eeprom_read_exit,
+	TP_PROTO(loff_t offset, size_t len, ssize_t ret, ktime_t start),
+	TP_ARGS(offset, len, ret, start)
+);
+
+DEFINE_EVENT(eeprom_rw_exit, eeprom_write_exit,
+	TP_PROTO(loff_t offset, size_t len, ssize_t ret, ktime_t start),
+	TP_ARGS(offset, len, ret, start)
+);
+
+#endif /* _EEPROM_TRACE_H_ */
+
+/*
+ * This part must be outside the multi-read protection
+ */
+#undef TRACE_INCLUDE_PATH
+#define TRACE_INCLUDE_PATH .
+#undef TRACE_INCLUDE_FILE
+#define TRACE_INCLUDE_FILE eeprom_trace
+#include <trace/define_trace.h>